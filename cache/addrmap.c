@@ -0,0 +1,158 @@
+/*
+ * addrmap.c - Hash map from 64-bit addresses to longs
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrmap.h"
+
+struct addrmap {
+    uint64_t *keys;
+    long *values;
+    unsigned char *used;
+    size_t mask;   /* capacity - 1; capacity is a power of two */
+    size_t count;
+};
+
+/* Finalizer from splitmix64; spreads nearby block numbers apart */
+static size_t hash(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t) key;
+}
+
+static void alloc_table(addrmap_t *map, size_t capacity)
+{
+    map->keys = malloc(capacity * sizeof(uint64_t));
+    map->values = malloc(capacity * sizeof(long));
+    map->used = calloc(capacity, 1);
+    map->mask = capacity - 1;
+    map->count = 0;
+}
+
+addrmap_t *addrmap_new(size_t hint)
+{
+    size_t capacity = 16;
+    addrmap_t *map = malloc(sizeof(addrmap_t));
+
+    while (capacity < 2 * hint)
+        capacity <<= 1;
+    alloc_table(map, capacity);
+    return map;
+}
+
+void addrmap_free(addrmap_t *map)
+{
+    if (map == NULL)
+        return;
+    free(map->keys);
+    free(map->values);
+    free(map->used);
+    free(map);
+}
+
+static size_t find(addrmap_t *map, uint64_t key)
+{
+    size_t i = hash(key) & map->mask;
+
+    while (map->used[i] && map->keys[i] != key)
+        i = (i + 1) & map->mask;
+    return i;
+}
+
+long *addrmap_get(addrmap_t *map, uint64_t key)
+{
+    size_t i = find(map, key);
+    return map->used[i] ? &map->values[i] : NULL;
+}
+
+static void grow(addrmap_t *map)
+{
+    uint64_t *keys = map->keys;
+    long *values = map->values;
+    unsigned char *used = map->used;
+    size_t capacity = map->mask + 1;
+
+    alloc_table(map, 2 * capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        if (used[i]) {
+            size_t j = find(map, keys[i]);
+            map->used[j] = 1;
+            map->keys[j] = keys[i];
+            map->values[j] = values[i];
+            map->count++;
+        }
+    }
+    free(keys);
+    free(values);
+    free(used);
+}
+
+long *addrmap_put(addrmap_t *map, uint64_t key, long dflt)
+{
+    size_t i = find(map, key);
+
+    if (!map->used[i]) {
+        if (2 * (map->count + 1) > map->mask + 1) {
+            grow(map);
+            i = find(map, key);
+        }
+        map->used[i] = 1;
+        map->keys[i] = key;
+        map->values[i] = dflt;
+        map->count++;
+    }
+    return &map->values[i];
+}
+
+/* Backward-shift deletion keeps probe sequences intact without tombstones */
+int addrmap_remove(addrmap_t *map, uint64_t key)
+{
+    size_t i = find(map, key);
+    size_t j;
+
+    if (!map->used[i])
+        return 0;
+    map->used[i] = 0;
+    map->count--;
+    for (j = (i + 1) & map->mask; map->used[j]; j = (j + 1) & map->mask) {
+        size_t home = hash(map->keys[j]) & map->mask;
+        /* move j back into the hole at i unless its home lies in (i, j] */
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->keys[i] = map->keys[j];
+            map->values[i] = map->values[j];
+            map->used[i] = 1;
+            map->used[j] = 0;
+            i = j;
+        }
+    }
+    return 1;
+}
+
+void addrmap_clear(addrmap_t *map)
+{
+    memset(map->used, 0, map->mask + 1);
+    map->count = 0;
+}
+
+size_t addrmap_size(addrmap_t *map)
+{
+    return map->count;
+}
+
+int addrmap_next(addrmap_t *map, size_t *pos, uint64_t *key, long *value)
+{
+    while (*pos <= map->mask) {
+        size_t i = (*pos)++;
+        if (map->used[i]) {
+            *key = map->keys[i];
+            *value = map->values[i];
+            return 1;
+        }
+    }
+    return 0;
+}
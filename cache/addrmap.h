@@ -0,0 +1,37 @@
+/*
+ * addrmap.h - Hash map from 64-bit addresses (or block numbers) to longs
+ *
+ * Open addressing with linear probing; the table doubles when it gets
+ * more than half full.  Used wherever the simulator needs per-block
+ * state that does not fit in the cache arrays themselves.
+ */
+#ifndef CACHELAB_ADDRMAP_H
+#define CACHELAB_ADDRMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct addrmap addrmap_t;
+
+addrmap_t *addrmap_new(size_t hint);
+void addrmap_free(addrmap_t *map);
+
+/* Value slot for key, or NULL if the key is absent */
+long *addrmap_get(addrmap_t *map, uint64_t key);
+
+/* Value slot for key, inserting it with value dflt if absent.  The
+ * pointer is valid until the next insertion or removal. */
+long *addrmap_put(addrmap_t *map, uint64_t key, long dflt);
+
+/* Remove key; returns 1 if it was present */
+int addrmap_remove(addrmap_t *map, uint64_t key);
+
+/* Remove every key, keeping the table allocated */
+void addrmap_clear(addrmap_t *map);
+
+size_t addrmap_size(addrmap_t *map);
+
+/* Visit every entry; *pos starts at 0.  Returns 0 when done. */
+int addrmap_next(addrmap_t *map, size_t *pos, uint64_t *key, long *value);
+
+#endif /* CACHELAB_ADDRMAP_H */
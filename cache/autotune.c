@@ -0,0 +1,446 @@
+/*
+ * autotune.c - Cache-simulator-driven search for blocked transposes
+ *
+ * For every requested shape, autotune enumerates parameterised
+ * transpose kernels, replays the exact address stream each one would
+ * produce through libcsim on the grading geometry, and emits the C code
+ * of the kernel with the fewest clock cycles, ready to paste into
+ * trans.c and register.
+ *
+ * The kernels are
+ *   blocked    bh x bw blocks of A (rows by columns), visited row-major
+ *   recursive  cache-oblivious halving of the longer side down to
+ *              leaf x leaf tiles
+ * and either moves each row of a block or tile straight from A to B,
+ * or uses tmp (which lives in the cache too) to
+ *   defer      hold the diagonal element until the rest of the row has
+ *              been written, so A's and B's copies of a diagonal block
+ *              do not evict each other halfway through the row
+ *   copy       stage each row of the block in tmp, then write it out
+ * The tmp offset is searched as well, since it picks the sets tmp uses.
+ *
+ * Addresses follow trans_arena_t (cachelab.h), the layout the graded
+ * matrices have: A, B and tmp are block aligned, B follows A and tmp
+ * follows B, and A and B are addressed with the row lengths M and N of
+ * the shape.  The grading cache and cycle counts come from cachelab.h
+ * too.
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cachelab.h"
+#include "libcsim.h"
+
+/* Where the arena starts; any block-aligned address gives the same
+ * conflicts, as only the offsets within it matter */
+#define A_BASE 0x600000UL
+#define B_BASE (A_BASE + offsetof(trans_arena_t, B))
+#define T_BASE (A_BASE + offsetof(trans_arena_t, tmp))
+
+#define KIND_BLOCKED 0
+#define KIND_RECURSIVE 1
+
+#define DIAG_NONE 0
+#define DIAG_DEFER 1
+#define DIAG_COPY 2
+
+#define TMP_STEP 8  /* tmp offsets tried, in doubles (one per block) */
+#define MAX_SIZES 32
+
+/* represents one kernel of the search space */
+typedef struct {
+    int kind;
+    int bh;        /* block height, or the recursion leaf */
+    int bw;        /* block width, or the recursion leaf */
+    int diag;
+    int tmpoff;    /* first tmp slot used */
+    long hits;
+    long misses;
+    long cycles;
+} variant;
+
+/* represents a replay of one kernel: the simulated cache and, to check
+ * the kernel really transposes, the A element each B element and tmp
+ * slot received */
+typedef struct {
+    csim_t *sim;
+    size_t M;
+    size_t N;
+    long *bsrc;
+    long tsrc[TMPCOUNT];
+} replay;
+
+/* The three moves a kernel makes, each a load and a store */
+static void a_to_b(replay* r, size_t i, size_t j) {
+    csim_access(r->sim, 'L', A_BASE + (i * r->M + j) * sizeof(double), 8);
+    csim_access(r->sim, 'S', B_BASE + (j * r->N + i) * sizeof(double), 8);
+    r->bsrc[j * r->N + i] = i * r->M + j;
+}
+
+static void a_to_t(replay* r, size_t i, size_t j, int k) {
+    csim_access(r->sim, 'L', A_BASE + (i * r->M + j) * sizeof(double), 8);
+    csim_access(r->sim, 'S', T_BASE + k * sizeof(double), 8);
+    r->tsrc[k] = i * r->M + j;
+}
+
+static void t_to_b(replay* r, int k, size_t i, size_t j) {
+    csim_access(r->sim, 'L', T_BASE + k * sizeof(double), 8);
+    csim_access(r->sim, 'S', B_BASE + (j * r->N + i) * sizeof(double), 8);
+    r->bsrc[j * r->N + i] = r->tsrc[k];
+}
+
+/* tile moves rows [i0, i1) by columns [j0, j1) of A */
+static void tile(replay* r, variant* v, size_t i0, size_t i1, size_t j0,
+                 size_t j1) {
+    for (size_t i = i0; i < i1; i++) {
+        size_t j;
+        switch (v->diag) {
+        case DIAG_NONE:
+            for (j = j0; j < j1; j++) {
+                a_to_b(r, i, j);
+            }
+            break;
+        case DIAG_DEFER:
+            for (j = j0; j < j1; j++) {
+                if (i == j) a_to_t(r, i, j, v->tmpoff);
+                else a_to_b(r, i, j);
+            }
+            if (i >= j0 && i < j1) t_to_b(r, v->tmpoff, i, i);
+            break;
+        case DIAG_COPY:
+            for (j = j0; j < j1; j++) {
+                a_to_t(r, i, j, v->tmpoff + (int) (j - j0));
+            }
+            for (j = j0; j < j1; j++) {
+                t_to_b(r, v->tmpoff + (int) (j - j0), i, j);
+            }
+            break;
+        }
+    }
+}
+
+static void recurse(replay* r, variant* v, size_t i0, size_t i1, size_t j0,
+                    size_t j1) {
+    size_t mid;
+    if (i1 - i0 <= (size_t) v->bh && j1 - j0 <= (size_t) v->bw) {
+        tile(r, v, i0, i1, j0, j1);
+    } else if (i1 - i0 >= j1 - j0) {
+        mid = i0 + (i1 - i0) / 2;
+        recurse(r, v, i0, mid, j0, j1);
+        recurse(r, v, mid, i1, j0, j1);
+    } else {
+        mid = j0 + (j1 - j0) / 2;
+        recurse(r, v, i0, i1, j0, mid);
+        recurse(r, v, i0, i1, mid, j1);
+    }
+}
+
+/* score replays a kernel on an empty cache and fills in its counters */
+static void score(variant* v, size_t M, size_t N, int s, int E, int b) {
+    replay r;
+    csim_stats_t stats;
+
+    r.sim = csim_new(s, E, b, NULL);
+    r.M = M;
+    r.N = N;
+    r.bsrc = malloc(M * N * sizeof(long));
+    memset(r.bsrc, -1, M * N * sizeof(long));
+    if (r.sim == NULL || r.bsrc == NULL) exit(1);
+
+    if (v->kind == KIND_RECURSIVE) {
+        recurse(&r, v, 0, N, 0, M);
+    } else {
+        for (size_t row = 0; row < N; row += v->bh) {
+            for (size_t col = 0; col < M; col += v->bw) {
+                tile(&r, v, row, row + v->bh < N ? row + v->bh : N,
+                     col, col + v->bw < M ? col + v->bw : M);
+            }
+        }
+    }
+
+    /* every kernel must be a transpose; anything else is a bug here */
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < M; j++) {
+            if (r.bsrc[j * N + i] != (long) (i * M + j)) {
+                fprintf(stderr, "autotune: kernel does not transpose\n");
+                exit(1);
+            }
+        }
+    }
+
+    csim_stats(r.sim, &stats);
+    v->hits = stats.hits;
+    v->misses = stats.misses;
+    v->cycles = HIT_CYCLES * stats.hits + MISS_CYCLES * stats.misses;
+    csim_free(r.sim);
+    free(r.bsrc);
+}
+
+static void describe(variant* v, char* buf) {
+    int n;
+    if (v->kind == KIND_RECURSIVE) {
+        n = sprintf(buf, "recursive, %dx%d leaves", v->bh, v->bw);
+    } else {
+        n = sprintf(buf, "blocked %dx%d", v->bh, v->bw);
+    }
+    if (v->diag == DIAG_DEFER) {
+        sprintf(buf + n, ", diagonal deferred via tmp[%d]", v->tmpoff);
+    } else if (v->diag == DIAG_COPY) {
+        sprintf(buf + n, ", rows staged in tmp[%d..]", v->tmpoff);
+    }
+}
+
+/* emitrow writes the statements that move row i of a tile whose
+ * columns start at lo and satisfy cond */
+static void emitrow(FILE* out, variant* v, const char* ind, const char* lo,
+                    const char* cond, const char* indiag) {
+    switch (v->diag) {
+    case DIAG_NONE:
+        fprintf(out, "%sfor (j = %s; %s; j++)\n", ind, lo, cond);
+        fprintf(out, "%s    B[j][i] = A[i][j];\n", ind);
+        break;
+    case DIAG_DEFER:
+        fprintf(out, "%sfor (j = %s; %s; j++) {\n", ind, lo, cond);
+        fprintf(out, "%s    if (i == j)\n", ind);
+        fprintf(out, "%s        tmp[%d] = A[i][j];\n", ind, v->tmpoff);
+        fprintf(out, "%s    else\n", ind);
+        fprintf(out, "%s        B[j][i] = A[i][j];\n", ind);
+        fprintf(out, "%s}\n", ind);
+        fprintf(out, "%sif (%s)\n", ind, indiag);
+        fprintf(out, "%s    B[i][i] = tmp[%d];\n", ind, v->tmpoff);
+        break;
+    case DIAG_COPY:
+        fprintf(out, "%sfor (j = %s; %s; j++)\n", ind, lo, cond);
+        fprintf(out, "%s    tmp[%d + j - %s] = A[i][j];\n", ind, v->tmpoff, lo);
+        fprintf(out, "%sfor (j = %s; %s; j++)\n", ind, lo, cond);
+        fprintf(out, "%s    B[j][i] = tmp[%d + j - %s];\n", ind, v->tmpoff, lo);
+        break;
+    }
+}
+
+/* emit writes the C code of a kernel as a trans.c function */
+static void emit(FILE* out, variant* v, size_t M, size_t N, int s, int E,
+                 int b) {
+    char name[32], what[96], cond[64], indiag[64];
+
+    sprintf(name, "trans_%zux%zu", M, N);
+    describe(v, what);
+    fprintf(out, "/*\n * %s - Autotuned for M=%zu, N=%zu on s=%d, E=%d, b=%d:\n"
+            " *     %s\n *     hits:%ld misses:%ld clock_cycles:%ld\n */\n",
+            name, M, N, s, E, b, what, v->hits, v->misses, v->cycles);
+
+    if (v->kind == KIND_RECURSIVE) {
+        fprintf(out, "static void %s_rec(size_t M, size_t N, double A[N][M], "
+                "double B[M][N], double *tmp,\n    size_t i0, size_t i1, "
+                "size_t j0, size_t j1)\n{\n", name);
+        fprintf(out, "    size_t i, j, mid;\n\n");
+        fprintf(out, "    if (i1 - i0 <= %d && j1 - j0 <= %d) {\n",
+                v->bh, v->bw);
+        fprintf(out, "        for (i = i0; i < i1; i++) {\n");
+        emitrow(out, v, "            ", "j0", "j < j1", "i >= j0 && i < j1");
+        fprintf(out, "        }\n");
+        fprintf(out, "    } else if (i1 - i0 >= j1 - j0) {\n");
+        fprintf(out, "        mid = i0 + (i1 - i0) / 2;\n");
+        fprintf(out, "        %s_rec(M, N, A, B, tmp, "
+                "i0, mid, j0, j1);\n", name);
+        fprintf(out, "        %s_rec(M, N, A, B, tmp, "
+                "mid, i1, j0, j1);\n", name);
+        fprintf(out, "    } else {\n");
+        fprintf(out, "        mid = j0 + (j1 - j0) / 2;\n");
+        fprintf(out, "        %s_rec(M, N, A, B, tmp, "
+                "i0, i1, j0, mid);\n", name);
+        fprintf(out, "        %s_rec(M, N, A, B, tmp, "
+                "i0, i1, mid, j1);\n", name);
+        fprintf(out, "    }\n}\n\n");
+    }
+
+    fprintf(out, "char %s_desc[] = \"Autotuned %zux%zu: %s\";\n\n", name, M, N,
+            what);
+    fprintf(out, "void %s(size_t M, size_t N, double A[N][M], double B[M][N], "
+            "double *tmp)\n{\n", name);
+    if (v->kind == KIND_RECURSIVE) {
+        fprintf(out, "    %s_rec(M, N, A, B, tmp, 0, N, 0, M);\n}\n", name);
+        return;
+    }
+    sprintf(cond, "j < col + %d && j < M", v->bw);
+    sprintf(indiag, "i >= col && i < col + %d && i < M", v->bw);
+    fprintf(out, "    size_t row, col, i, j;\n\n");
+    fprintf(out, "    for (row = 0; row < N; row += %d) {\n", v->bh);
+    fprintf(out, "        for (col = 0; col < M; col += %d) {\n", v->bw);
+    fprintf(out, "            for (i = row; i < row + %d && i < N; i++) {\n",
+            v->bh);
+    emitrow(out, v, "                ", "col", cond, indiag);
+    fprintf(out, "            }\n        }\n    }\n}\n");
+}
+
+/* tune searches every kernel for one shape; returns the best one */
+static variant tune(size_t M, size_t N, int* sizes, int nsizes, int s, int E,
+                    int b, int top) {
+    variant *vs = NULL;
+    int n = 0, cap = 0;
+    variant best;
+
+    for (int kind = KIND_BLOCKED; kind <= KIND_RECURSIVE; kind++) {
+        for (int h = 0; h < nsizes; h++) {
+            /* recursion leaves are square */
+            for (int w = 0; w < nsizes; w++) {
+                if (kind == KIND_RECURSIVE && w != h) continue;
+                for (int diag = DIAG_NONE; diag <= DIAG_COPY; diag++) {
+                    /* a kernel is listed once, with its best tmp offset,
+                     * so offsets of one kernel do not crowd the ranking */
+                    if (diag == DIAG_COPY && sizes[w] > TMPCOUNT) continue;
+                    if (n == cap) {
+                        cap = cap ? 2 * cap : 256;
+                        vs = realloc(vs, cap * sizeof(variant));
+                    }
+                    for (int off = 0; off < TMPCOUNT; off += TMP_STEP) {
+                        variant v;
+                        if (diag == DIAG_NONE && off > 0) break;
+                        if (diag == DIAG_COPY && off + sizes[w] > TMPCOUNT) {
+                            break;
+                        }
+                        v.kind = kind;
+                        v.bh = sizes[h];
+                        v.bw = sizes[w];
+                        v.diag = diag;
+                        v.tmpoff = off;
+                        score(&v, M, N, s, E, b);
+                        if (off == 0 || v.cycles < vs[n].cycles) vs[n] = v;
+                    }
+                    n++;
+                }
+            }
+        }
+    }
+
+    /* rank the first few by selection; shifting rather than swapping
+     * keeps ties in enumeration order, which lists simpler kernels first */
+    fprintf(stderr, "M=%zu N=%zu: %d kernels\n", M, N, n);
+    for (int k = 0; k < top && k < n; k++) {
+        int at = k;
+        char what[96];
+        for (int i = k + 1; i < n; i++) {
+            if (vs[i].cycles < vs[at].cycles) at = i;
+        }
+        best = vs[at];
+        memmove(&vs[k + 1], &vs[k], (at - k) * sizeof(variant));
+        vs[k] = best;
+        describe(&vs[k], what);
+        fprintf(stderr, "  %2d  hits:%-7ld misses:%-7ld "
+                "clock_cycles:%-8ld %s\n", k + 1, vs[k].hits, vs[k].misses,
+                vs[k].cycles, what);
+    }
+    best = vs[0];
+    free(vs);
+    return best;
+}
+
+static void usage(char* cmd) {
+    fprintf(stderr, "Usage: %s [-h] [-s <s>] [-E <E>] [-b <b>] [-B sizes] "
+            "[-n top] [-o out.c]\n        (-M <M> -N <N> | -S MxN,...)\n", cmd);
+    fprintf(stderr, "  -s, -E, -b   Cache to tune for (default 5, 1, 6 as graded)\n");
+    fprintf(stderr, "  -M, -N       Shape to tune (A is N x M)\n");
+    fprintf(stderr, "  -S MxN,...   Several shapes; one kernel is emitted for each\n");
+    fprintf(stderr, "  -B sizes     Block sizes and leaves tried (default 2,4,6,8,12,16)\n");
+    fprintf(stderr, "  -n <top>     Kernels listed per shape on stderr (default 5)\n");
+    fprintf(stderr, "  -o <file>    Write the kernels there instead of stdout\n");
+    exit(1);
+}
+
+/* addshape parses one MxN shape */
+static int addshape(char* text, size_t* Ms, size_t* Ns, int n) {
+    int M, N;
+    if (n == MAX_SIZES || sscanf(text, "%dx%d", &M, &N) != 2
+        || M < 1 || N < 1 || M > MAXN || N > MAXN) {
+        return -1;
+    }
+    Ms[n] = M;
+    Ns[n] = N;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int s = TEST_LOG_SET, E = TEST_ASSOC, b = TEST_LOG_BLOCK;
+    int M = 0, N = 0;
+    int sizes[MAX_SIZES] = {2, 4, 6, 8, 12, 16};
+    int nsizes = 6;
+    size_t Ms[MAX_SIZES], Ns[MAX_SIZES];
+    int nshapes = 0;
+    int top = 5;
+    char *out_name = NULL;
+    char *tok;
+    int c;
+
+    while ((c = getopt(argc, argv, "hs:E:b:M:N:S:B:n:o:")) != -1) {
+        switch (c) {
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 'S':
+            for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+                if (addshape(tok, Ms, Ns, nshapes) < 0) usage(argv[0]);
+                nshapes++;
+            }
+            break;
+        case 'B':
+            nsizes = 0;
+            for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+                if (nsizes == MAX_SIZES || atoi(tok) < 1) usage(argv[0]);
+                sizes[nsizes++] = atoi(tok);
+            }
+            break;
+        case 'n':
+            top = atoi(optarg);
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (M > 0 || N > 0) {
+        char shape[32];
+        sprintf(shape, "%dx%d", M, N);
+        if (addshape(shape, Ms, Ns, nshapes) < 0) usage(argv[0]);
+        nshapes++;
+    }
+    if (nshapes == 0 || nsizes == 0) usage(argv[0]);
+
+    csim_t *probe = csim_new(s, E, b, NULL);
+    if (probe == NULL) {
+        fprintf(stderr, "Invalid cache geometry s=%d E=%d b=%d\n", s, E, b);
+        exit(1);
+    }
+    csim_free(probe);
+
+    FILE *out = out_name ? fopen(out_name, "w") : stdout;
+    if (out == NULL) {
+        perror(out_name);
+        exit(1);
+    }
+    if (top < 1) top = 1;
+    for (int i = 0; i < nshapes; i++) {
+        variant best = tune(Ms[i], Ns[i], sizes, nsizes, s, E, b, top);
+        if (i > 0) fprintf(out, "\n");
+        emit(out, &best, Ms[i], Ns[i], s, E, b);
+    }
+    if (out != stdout) fclose(out);
+    return 0;
+}
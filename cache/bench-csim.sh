@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# bench-csim.sh - Measure csim's throughput on synthetic traces
+#
+# usage: bench-csim.sh <accesses> "<s:E:b> ..." [csim options]
+#
+# Generates one binary trace per pattern with gentrace (kept, as
+# bench.<pattern>.<accesses>.btrace, for later runs) and prints csim's
+# accesses per second for every pattern and geometry.
+#
+n=${1:-4M}
+geoms=${2:-"5:1:6 10:8:6 14:16:6"}
+shift 2 2>/dev/null
+patterns="seq stride random zipf chase trans"
+
+printf "%-8s %-10s %10s %9s %12s\n" pattern geometry accesses seconds accesses/s
+for p in $patterns; do
+    t=bench.$p.$n.btrace
+    if [ ! -f "$t" ]; then
+        ./gentrace -B -p "$p" -n "$n" -s 4160 -o "$t" || exit 1
+    fi
+    # an 8-byte header, then 16-byte records
+    count=$(( ($(wc -c < "$t") - 8) / 16 ))
+    for g in $geoms; do
+        IFS=: read s E b <<END
+$g
+END
+        start=$(date +%s.%N)
+        ./csim -s "$s" -E "$E" -b "$b" "$@" -t "$t" > /dev/null || exit 1
+        end=$(date +%s.%N)
+        echo "$p $g $count $start $end" | awk '{
+            secs = $5 - $4;
+            printf "%-8s %-10s %10d %9.3f %12.0f\n", $1, $2, $3, secs,
+                   (secs > 0 ? $3 / secs : 0) }'
+    done
+done
@@ -0,0 +1,363 @@
+/*
+ * bench-trans.c - Times the registered transpose functions natively.
+ *
+ * test-trans scores a function by its misses on a simulated 2KB
+ * cache; bench-trans runs the same functions on the real machine, on
+ * heap matrices of any size (not just up to MAXN), and reports
+ * nanoseconds per element, bandwidth (one read and one write of each
+ * element) and, where the kernel allows it, hardware cache misses per
+ * element from perf_event_open.  That shows whether what wins in the
+ * simulator also wins on real caches.
+ *
+ * With -P, it also reports how ptrans, the multithreaded transpose,
+ * scales from one thread up to the given number on each shape.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <stdbool.h>
+#include "cachelab.h"
+#include "ptrans.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/* External function defined in trans.c */
+extern void registerFunctions();
+
+/* External variables defined in cachelab.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+/* Default shapes: the graded ones, then ever larger squares */
+#define DEFAULT_SHAPES "32x32,64x64,63x65,256x256,1024x1024,2048x2048"
+
+/* Shapes to run (-S) */
+static size_t (*shapes)[2];
+static int nshapes;
+
+/* Hardware counters: L1 data read misses and last level misses */
+#define NCOUNTERS 2
+static const char *counter_names[NCOUNTERS] = {"l1d_miss/elem", "llc_miss/elem"};
+static int counter_fds[NCOUNTERS] = {-1, -1};
+
+/*
+ * open_counters - Open the hardware counters for this thread; any that
+ *     the kernel or the machine (say, a VM) refuses stay at -1
+ */
+void open_counters(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        if (i == 0) {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        } else {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        counter_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+void start_counters(void)
+{
+#ifdef __linux__
+    int i;
+    for (i = 0; i < NCOUNTERS; i++) {
+        if (counter_fds[i] >= 0) {
+            ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/*
+ * stop_counters - Stop the counters and read them into counts; a
+ *     counter that is not available reads as -1
+ */
+void stop_counters(long counts[NCOUNTERS])
+{
+    int i;
+    for (i = 0; i < NCOUNTERS; i++) {
+        uint64_t value;
+        counts[i] = -1;
+#ifdef __linux__
+        if (counter_fds[i] >= 0) {
+            ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter_fds[i], &value, sizeof(value)) == sizeof(value))
+                counts[i] = (long) value;
+        }
+#endif
+    }
+}
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * bench_one - Validate function i on an M x N matrix, then time it.
+ *     It is run until min_time seconds have passed (at least three
+ *     times), and the fastest run counts.  Returns false if the
+ *     function does not transpose.
+ */
+bool bench_one(int i, size_t M, size_t N, double min_time,
+               double *best, long counts[NCOUNTERS], int *runs)
+{
+    double (*A)[M], (*B)[N], *tmp;
+    double total = 0, t;
+    size_t r, c;
+    bool ok = true;
+
+    if (posix_memalign((void **) &A, 64, M * N * sizeof(double))
+        || posix_memalign((void **) &B, 64, M * N * sizeof(double))
+        || posix_memalign((void **) &tmp, 64, TMPCOUNT * sizeof(double))) {
+        fprintf(stderr, "Out of memory for %zdx%zd\n", M, N);
+        exit(1);
+    }
+    initMatrix(M, N, A, B);
+
+    /* The first run validates, and warms the caches and TLB */
+    (*func_list[i].func_ptr)(M, N, A, B, tmp);
+    for (r = 0; r < N && ok; r++)
+        for (c = 0; c < M; c++)
+            if (A[r][c] != B[c][r]) {
+                ok = false;
+                break;
+            }
+
+    *best = 0;
+    *runs = 0;
+    if (ok) {
+        start_counters();
+        while (*runs < 3 || total < min_time) {
+            t = now();
+            (*func_list[i].func_ptr)(M, N, A, B, tmp);
+            t = now() - t;
+            if (*runs == 0 || t < *best)
+                *best = t;
+            total += t;
+            (*runs)++;
+        }
+        stop_counters(counts);
+    }
+    free(A);
+    free(B);
+    free(tmp);
+    return ok;
+}
+
+/*
+ * bench_ptrans - Time ptrans on an M x N matrix with 1, 2, 4, ...
+ *     threads up to maxthreads, reporting the speedup over one thread
+ */
+void bench_ptrans(size_t M, size_t N, int maxthreads, double min_time)
+{
+    double (*A)[M], (*B)[N];
+    double base = 0, best, total, t;
+    size_t r, c;
+    int threads, runs;
+    char shape[32];
+
+    if (posix_memalign((void **) &A, 64, M * N * sizeof(double))
+        || posix_memalign((void **) &B, 64, M * N * sizeof(double))) {
+        fprintf(stderr, "Out of memory for %zdx%zd\n", M, N);
+        exit(1);
+    }
+    initMatrix(M, N, A, B);
+    sprintf(shape, "%zdx%zd", M, N);
+
+    for (threads = 1; ; threads = threads * 2 < maxthreads ? threads * 2
+                                                           : maxthreads) {
+        /* The first run validates, as in bench_one */
+        if (ptrans(M, N, &A[0][0], &B[0][0], threads) < 0) {
+            fprintf(stderr, "ptrans failed on %s\n", shape);
+            exit(1);
+        }
+        for (r = 0; r < N; r++)
+            for (c = 0; c < M; c++)
+                if (A[r][c] != B[c][r]) {
+                    printf("%-11s %7d: does not transpose\n", shape, threads);
+                    exit(1);
+                }
+
+        best = total = 0;
+        for (runs = 0; runs < 3 || total < min_time; runs++) {
+            t = now();
+            ptrans(M, N, &A[0][0], &B[0][0], threads);
+            t = now() - t;
+            if (runs == 0 || t < best)
+                best = t;
+            total += t;
+        }
+        if (threads == 1)
+            base = best;
+        printf("%-11s %7d %9.3f %8.2f %8.2f\n", shape, threads,
+               best * 1e9 / (M * N), 2.0 * sizeof(double) * M * N / best / 1e9,
+               base / best);
+        if (threads == maxthreads)
+            break;
+    }
+    free(A);
+    free(B);
+}
+
+/*
+ * add_shapes - Parse a comma separated list of MxN shapes; a bare N
+ *     means NxN
+ */
+bool add_shapes(char *list)
+{
+    char *shape;
+    int m, n;
+
+    for (shape = strtok(list, ","); shape; shape = strtok(NULL, ",")) {
+        int got = sscanf(shape, "%dx%d", &m, &n);
+        if (got == 1)
+            n = m;
+        else if (got != 2)
+            return false;
+        if (m <= 0 || n <= 0)
+            return false;
+        shapes = realloc(shapes, (nshapes + 1) * sizeof(*shapes));
+        shapes[nshapes][0] = m;
+        shapes[nshapes][1] = n;
+        nshapes++;
+    }
+    return nshapes > 0;
+}
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[]){
+    printf("Usage: %s [-h] [-n] [-F <func>] [-P <threads>] [-T <secs>] [-S <shapes>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -S <shapes> Comma separated MxN (or N for NxN) shapes, any size\n");
+    printf("              (default %s)\n", DEFAULT_SHAPES);
+    printf("  -F <func>   Only benchmark function number func\n");
+    printf("  -T <secs>   Minimum time to spend timing each function and shape\n");
+    printf("              (default 0.2)\n");
+    printf("  -n          Do not read hardware cache miss counters\n");
+    printf("  -P <n>      Also time ptrans on 1, 2, 4, ... up to n threads\n");
+    printf("Example: %s -S 64x64,4096 -F 0\n", argv[0]);
+    printf("         %s -F 4 -P 8 -S 6144\n", argv[0]);
+}
+
+/*
+ * main - Main routine
+ */
+int main(int argc, char* argv[])
+{
+    char default_shapes[] = DEFAULT_SHAPES;
+    int c, i, k, only = -1, maxthreads = 0;
+    double min_time = 0.2;
+    bool counters = true;
+
+    while ((c = getopt(argc, argv, "hnF:P:T:S:")) != -1) {
+        switch(c) {
+        case 'S':
+            if (!add_shapes(optarg)) {
+                printf("Error: Invalid shape list %s\n", optarg);
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'F':
+            only = atoi(optarg);
+            break;
+        case 'P':
+            maxthreads = atoi(optarg);
+            break;
+        case 'T':
+            min_time = atof(optarg);
+            break;
+        case 'n':
+            counters = false;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (nshapes == 0)
+        add_shapes(default_shapes);
+
+    registerFunctions();
+    if (only >= func_counter) {
+        printf("Error: There are only %d functions\n", func_counter);
+        exit(1);
+    }
+    if (counters)
+        open_counters();
+    if (counter_fds[0] < 0 && counter_fds[1] < 0)
+        printf("Hardware cache miss counters unavailable\n");
+
+    printf("%-5s %-11s %9s %8s %14s %14s  %s\n", "func", "shape",
+           "ns/elem", "GB/s", counter_names[0], counter_names[1],
+           "description");
+    for (k = 0; k < nshapes; k++) {
+        size_t M = shapes[k][0], N = shapes[k][1];
+        char shape[32];
+
+        sprintf(shape, "%zdx%zd", M, N);
+        for (i = 0; i < func_counter; i++) {
+            double best;
+            long counts[NCOUNTERS];
+            int runs, j;
+
+            if (only >= 0 && i != only)
+                continue;
+            if (!bench_one(i, M, N, min_time, &best, counts, &runs)) {
+                printf("%-5d %-11s %s: does not transpose\n", i, shape,
+                       func_list[i].description);
+                continue;
+            }
+            printf("%-5d %-11s %9.3f %8.2f", i, shape,
+                   best * 1e9 / (M * N),
+                   2.0 * sizeof(double) * M * N / best / 1e9);
+            for (j = 0; j < NCOUNTERS; j++) {
+                if (counts[j] < 0)
+                    printf(" %14s", "-");
+                else
+                    printf(" %14.4f", (double) counts[j] / runs / (M * N));
+            }
+            printf("  %s\n", func_list[i].description);
+        }
+    }
+
+    if (maxthreads > 0) {
+        printf("\nptrans scaling\n%-11s %7s %9s %8s %8s\n", "shape",
+               "threads", "ns/elem", "GB/s", "speedup");
+        for (k = 0; k < nshapes; k++)
+            bench_ptrans(shapes[k][0], shapes[k][1], maxthreads, min_time);
+    }
+    return 0;
+}
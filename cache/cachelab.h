@@ -13,6 +13,26 @@
 /* Number of temp's allocated in temp array.  Designed to fill cache to capacity */
 #define TMPCOUNT 256
 
+/* Grading parameters, shared by test-trans and autotune */
+// Number of clock cycles for hit
+#define HIT_CYCLES 4
+// Number of clock cycles for miss
+#define MISS_CYCLES 100
+// Log number of sets
+#define TEST_LOG_SET 5
+// Associativity
+#define TEST_ASSOC 1
+// Log number of bytes / block
+#define TEST_LOG_BLOCK 6
+
+/* The matrices a transpose is graded on, in the order they lie in
+ * memory: B right after A, and tmp right after B */
+typedef struct trans_arena {
+    double A[MAXN][MAXN];
+    double B[MAXN][MAXN];
+    double tmp[TMPCOUNT];
+} trans_arena_t;
+
 
 typedef struct trans_func{
     void (*func_ptr)(size_t M, size_t N, double[N][M], double[M][N], double*);
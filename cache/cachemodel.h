@@ -0,0 +1,234 @@
+/*
+ * cachemodel.h - Internals of the cache model shared by csim and
+ *     libcsim.c.  Programs that only need to feed accesses to a cache
+ *     should use libcsim.h instead.
+ */
+#ifndef CACHELAB_CACHEMODEL_H
+#define CACHELAB_CACHEMODEL_H
+
+#include "trace.h"
+#include "addrmap.h"
+
+/* represents a set in structure-of-arrays form: the tags, use stamps
+ * and dirty bits of its E lines each live in their own contiguous array,
+ * so a single pass (or a few SIMD compares) covers the whole set.
+ * usecount is the replacement policy's stamp for the line (for LRU,
+ * opnum + 1 of the operation that last used it); 0 marks an invalid
+ * line, which makes invalid lines the natural victims.  meta holds
+ * extra per-line policy state (RRPVs, or the nodes of a PLRU tree) */
+typedef struct {
+    long* tags;
+    long* usecount;
+    char* isdirty;
+    unsigned char* meta;
+    char* isprefetched; /* filled by a prefetch and not yet demanded */
+    unsigned char* state; /* coherence state of the line (multicore) */
+} cache_set;
+
+/* represents a whole cache; the per-set arrays are slices of these */
+typedef struct {
+    cache_set* sets;
+    long* tags;
+    long* usecount;
+    char* isdirty;
+    unsigned char* meta;
+    char* isprefetched;
+    unsigned char* state;
+} cache;
+
+/* represents dirty evicted/cached counter, as well as dimension of cache */
+typedef struct {
+    int s;
+    int E;
+    int b;
+    long devicted;
+    long dcached;
+} dim;
+
+typedef struct config config;
+
+/* represents the three-C classifier of a configuration (-C): every
+ * block seen so far, and a fully associative LRU shadow cache of the
+ * same capacity.  A miss on a block never seen is compulsory, one the
+ * shadow misses too is a capacity miss, and the rest are conflicts */
+typedef struct {
+    addrmap_t* blocks; /* seen block -> its shadow node, -1 if not resident */
+    unsigned long* block; /* shadow nodes, allocated as they are needed */
+    long* prev;
+    long* next;
+    long head;         /* most recently used node */
+    long tail;         /* least recently used node */
+    long used;
+    long allocated;
+    long capacity;
+    long compulsory;
+    long capacitymiss;
+    long conflict;
+    long* setconflict; /* conflict misses per set */
+} classifier;
+
+/* represents a replacement policy.  touch is called with the line an
+ * operation hit (fill == 0) or was filled into (fill == 1) and must
+ * leave its usecount nonzero; victim picks the line to evict from a
+ * full set, given the smallest-usecount line lookup found */
+typedef struct {
+    char* name;
+    void (*touch)(config* cfg, cache_set* set, int line, long opnum, int fill);
+    int (*victim)(config* cfg, cache_set* set, int lru_line, long opnum);
+} policy;
+
+/* represents the heatmap of a configuration (-H): hits, misses and
+ * evictions per set and per address region of 2^regionbits bytes.
+ * Evictions are charged to the set and region of the evicted block */
+typedef struct {
+    long (*sets)[3];
+    addrmap_t* regions; /* region number -> its row in regionstats */
+    long (*regionstats)[3];
+    unsigned long* regionids;
+    long nregions;
+    int regionbits;
+} heatmap;
+
+/* represents a hardware prefetcher (-p).  train sees every demand
+ * access; trigger is set for misses and first hits on prefetched lines,
+ * which are the events a tagged prefetcher reacts to */
+typedef struct {
+    char* name;
+    void (*train)(config* cfg, unsigned long address, int trigger, long opnum);
+} prefetcher;
+
+#define STRIDE_ENTRIES 64 /* reference prediction table, one entry per page */
+#define STREAM_COUNT 4    /* streams followed at once */
+#define STREAM_DEPTH 4    /* blocks a stream runs ahead of its last use */
+
+/* represents a stride table entry: the page it follows, the last
+ * address accessed there and the stride leading to it */
+typedef struct {
+    unsigned long page;
+    unsigned long last;
+    long stride;
+    int confidence;
+} stride_entry;
+
+/* represents a prefetcher's tables and its counters.  useful counts
+ * prefetched lines later demanded, useless those evicted first, and
+ * pollution the demand misses on blocks a prefetch had evicted */
+typedef struct {
+    prefetcher* pf;
+    long issued;
+    long useful;
+    long useless;
+    long pollution;
+    long evict;
+    addrmap_t* polluted; /* blocks evicted by prefetches, not yet missed */
+    stride_entry stride[STRIDE_ENTRIES];
+    struct {
+        long head;         /* last block the stream prefetched */
+        int dir;           /* +1 ascending, -1 descending, 0 unused */
+        long lastuse;
+    } streams[STREAM_COUNT];
+    long lastmiss;
+} prefetch_state;
+
+/* represents a write-combining buffer (-W) between a write-through or
+ * no-write-allocate cache and the next level.  Each entry collects the
+ * writes to one block in a mask of up to 64 chunks; an entry leaves
+ * (oldest first) when the buffer needs room, and only then are the
+ * chunks it collected written */
+typedef struct {
+    unsigned long* blocks;
+    unsigned long* masks;
+    int size;
+    int used;
+    int next;  /* entry to flush next, once full */
+    long merges;
+} wcbuffer;
+
+/* set index functions (-x).  mod takes the set from address bits
+ * [b, b+s) and the tag from the bits above; the others hash the whole
+ * block number, which then serves as the tag.  xor folds the block
+ * number s bits at a time, prime takes it modulo the largest prime
+ * below 2^s (leaving the sets above unused), and skew gives every way
+ * a hash of its own, so a block may live in a different set per way */
+#define IDX_MOD 0
+#define IDX_XOR 1
+#define IDX_PRIME 2
+#define IDX_SKEW 3
+
+/* represents one simulated configuration: the cache, its dimension,
+ * replacement policy and its hit/miss/evict counters */
+struct config {
+    dim* ourdim;
+    cache* cache;
+    policy* policy;
+    long* nextuse; /* OPT only: opnum of the next use of each access's block */
+    long setmask;
+    long tagmask;
+    int index;     /* set index function, IDX_MOD unless -x */
+    long prime;    /* -x prime: number of sets in use */
+    long hit;
+    long miss;
+    long evict;
+    long backinval; /* lines removed to keep a lower level inclusive */
+    long splits;    /* accesses that straddled blocks (-z) */
+    int writethrough;  /* -w wt: stores go to the next level right away */
+    int noallocate;    /* -n: store misses do not fill */
+    wcbuffer* wc;      /* -W only */
+    long bytesread;    /* bytes fetched from the next level */
+    long byteswritten; /* bytes written to it, besides dirty evictions */
+    classifier* classes; /* -C only */
+    heatmap* heat;       /* -H only */
+    prefetch_state* pf;  /* -p only */
+};
+
+/* represents a line pushed out of a cache by a fill */
+typedef struct {
+    int valid;
+    unsigned long address;
+    int dirty;
+    int prefetched; /* a prefetched line that was never used */
+} evicted_line;
+
+/* the replacement policies, lru first */
+extern policy policies[];
+policy* findpolicy(char* name);
+prefetcher* findprefetcher(char* name);
+
+/* checkdim rejects (with a message) dimensions that cannot be simulated */
+int checkdim(int s, int E, int b, policy* pol);
+config* make_config(int s, int E, int b, policy* pol);
+void freeconfig(config* cfg);
+void computenextuse(config* cfg, const trace_rec_t* recs, long n);
+
+/* optional per-configuration instruments and variants */
+void make_heatmap(config* cfg, int regionbits);
+void make_classifier(config* cfg);
+void make_wcbuffer(config* cfg, int n);
+void wcdrain(config* cfg);
+void make_prefetcher(config* cfg, prefetcher* pf);
+/* setindexing picks the set index function by name (mod, xor, prime,
+ * skew); returns -1, with a message, if it cannot be used */
+int setindexing(config* cfg, char* name);
+
+/* single-set operations */
+cache_set* locate(config* cfg, unsigned long address, long* setindex,
+                  long* addrtag);
+int lookup(cache_set* targetset, long addrtag, int max_lines, int* victim);
+int fill(config* cfg, cache_set* targetset, long setindex, long addrtag,
+         int victim, long opnum, evicted_line* out);
+void markdirty(config* cfg, cache_set* targetset, int line);
+
+/* whole accesses */
+int simulate(config* cfg, char op, unsigned long address, unsigned int size,
+             long opnum, evicted_line* out);
+long pieces(config* cfg, unsigned long address, unsigned int size,
+            int sized);
+unsigned long piece(config* cfg, unsigned long address, long k);
+unsigned int piecebytes(config* cfg, unsigned long address, unsigned int size,
+                        long n, long k);
+int invalidate(config* cfg, unsigned long address, int* dirty);
+int probe(config* cfg, unsigned long address, int* dirty);
+void insert(config* cfg, unsigned long address, int dirty, long opnum,
+            evicted_line* out);
+
+#endif /* CACHELAB_CACHEMODEL_H */
@@ -0,0 +1,555 @@
+/*
+ * csim-mrc.c - One-pass reuse distance analyzer producing miss ratio
+ *     curves for fully associative LRU caches
+ *
+ * The stack distance of an access (Mattson et al.) is the number of
+ * distinct blocks touched since the previous access to the same block.
+ * A fully associative LRU cache of C blocks hits exactly the accesses
+ * whose distance is below C, so a single histogram of distances gives
+ * the miss ratio of every cache size at once.
+ *
+ * Distances come from a Fenwick tree over access times in which only
+ * the latest access to each block is marked: the distance is the number
+ * of marks after the block's previous access, an O(log n) query.  Every
+ * block size in the requested range is analyzed in the same pass.
+ *
+ * For traces too large for that, -R switches to SHARDS sampling
+ * (Waldspurger et al., FAST '15): only blocks whose spatial hash falls
+ * below a threshold are tracked, and their distances and counts are
+ * scaled up by the inverse sampling rate.  With -m the number of
+ * tracked blocks is bounded as well; whenever it is exceeded the
+ * threshold drops to evict the block with the largest hash, and later
+ * samples are weighted by the new, lower rate.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "trace.h"
+#include "addrmap.h"
+
+/* represents the analysis for one block size */
+typedef struct {
+    int b;
+    addrmap_t *last;      /* block -> time of its latest access */
+    unsigned int *tree;   /* Fenwick tree over access times, 1-based */
+    long n;               /* number of access times in the tree */
+    long *hist;           /* hist[d] = accesses at stack distance d */
+    long histlen;
+    long cold;            /* first touches, at infinite distance */
+    long total;
+} analyzer;
+
+analyzer* make_analyzer(int b, long n) {
+    analyzer *an = calloc(1, sizeof(analyzer));
+    an->b = b;
+    an->n = n;
+    an->last = addrmap_new(1024);
+    an->tree = calloc(n + 1, sizeof(unsigned int));
+    an->histlen = 1024;
+    an->hist = calloc(an->histlen, sizeof(long));
+    if (an->tree == NULL || an->hist == NULL) {
+        fprintf(stderr, "Out of memory for %ld accesses\n", n);
+        exit(1);
+    }
+    return an;
+}
+
+void free_analyzer(analyzer* an) {
+    addrmap_free(an->last);
+    free(an->tree);
+    free(an->hist);
+    free(an);
+}
+
+/* Fenwick tree primitives over times 1..n */
+void fenwick_add(analyzer* an, long t, int delta) {
+    for (; t <= an->n; t += t & -t) {
+        an->tree[t] += delta;
+    }
+}
+
+long fenwick_sum(analyzer* an, long t) {
+    long sum = 0;
+    for (; t > 0; t -= t & -t) {
+        sum += an->tree[t];
+    }
+    return sum;
+}
+
+/* record adds one stack distance to the histogram */
+void record(analyzer* an, long dist) {
+    if (dist >= an->histlen) {
+        long len = an->histlen;
+        while (dist >= len) len *= 2;
+        an->hist = realloc(an->hist, len * sizeof(long));
+        memset(an->hist + an->histlen, 0, (len - an->histlen) * sizeof(long));
+        an->histlen = len;
+    }
+    an->hist[dist]++;
+}
+
+/* analyze processes the access at time t (1-based) */
+void analyze(analyzer* an, unsigned long address, long t) {
+    long *last = addrmap_put(an->last, address >> an->b, 0);
+
+    if (*last == 0) {
+        an->cold++;
+    } else {
+        record(an, fenwick_sum(an, t - 1) - fenwick_sum(an, *last));
+        fenwick_add(an, *last, -1);
+    }
+    fenwick_add(an, t, 1);
+    *last = t;
+    an->total++;
+}
+
+/* exactratio is the miss ratio of a fully associative cache of c blocks */
+double exactratio(analyzer* an, long c) {
+    long hits = 0;
+    for (long d = 0; d < c && d < an->histlen; d++) {
+        hits += an->hist[d];
+    }
+    return an->total ? 1.0 - (double) hits / an->total : 0.0;
+}
+
+/*
+ * SHARDS sampling.  Tracked blocks live in a treap keyed by the time of
+ * their latest access, with subtree sizes, so the stack distance among
+ * tracked blocks is the number of keys after the previous access.  The
+ * treap only holds tracked blocks, which bounds the memory.
+ */
+#define SHARDS_MOD (1 << 24)  /* hashes are taken modulo this */
+#define HIST_BINS (1 << 20)   /* sampled histogram is coarsened past this */
+
+typedef struct {
+    long key;              /* time of the block's latest access */
+    unsigned long block;
+    unsigned int prio;
+    int left, right;       /* node indices, -1 for none */
+    long size;
+} tnode;
+
+/* represents a sampled analysis for one block size */
+typedef struct {
+    int b;
+    long threshold;        /* blocks with hash below this are sampled */
+    long smax;             /* bound on tracked blocks, 0 for none */
+    addrmap_t *where;      /* tracked block -> its treap node */
+    tnode *nodes;
+    long nnodes, nodecap;
+    int root, freelist;
+    long *heap;            /* max-heap of tracked nodes by hash (-m) */
+    long heaplen;
+    double *hist;          /* weight at scaled distance [k, k+1) << shift */
+    int shift;
+    double cold;
+    double total;
+} sampler;
+
+unsigned long blockhash(unsigned long block) {
+    block ^= block >> 33;
+    block *= 0xff51afd7ed558ccdUL;
+    block ^= block >> 33;
+    block *= 0xc4ceb9fe1a85ec53UL;
+    block ^= block >> 33;
+    return block % SHARDS_MOD;
+}
+
+long tsize(sampler* sp, int t) {
+    return t < 0 ? 0 : sp->nodes[t].size;
+}
+
+void tfix(sampler* sp, int t) {
+    sp->nodes[t].size = 1 + tsize(sp, sp->nodes[t].left)
+                          + tsize(sp, sp->nodes[t].right);
+}
+
+/* tsplit splits t into keys <= key (*l) and keys > key (*r) */
+void tsplit(sampler* sp, int t, long key, int* l, int* r) {
+    if (t < 0) {
+        *l = *r = -1;
+    } else if (sp->nodes[t].key <= key) {
+        tsplit(sp, sp->nodes[t].right, key, &sp->nodes[t].right, r);
+        *l = t;
+        tfix(sp, t);
+    } else {
+        tsplit(sp, sp->nodes[t].left, key, l, &sp->nodes[t].left);
+        *r = t;
+        tfix(sp, t);
+    }
+}
+
+int tmerge(sampler* sp, int l, int r) {
+    if (l < 0) return r;
+    if (r < 0) return l;
+    if (sp->nodes[l].prio > sp->nodes[r].prio) {
+        sp->nodes[l].right = tmerge(sp, sp->nodes[l].right, r);
+        tfix(sp, l);
+        return l;
+    }
+    sp->nodes[r].left = tmerge(sp, l, sp->nodes[r].left);
+    tfix(sp, r);
+    return r;
+}
+
+/* tafter counts the keys greater than key */
+long tafter(sampler* sp, long key) {
+    long count = 0;
+    for (int t = sp->root; t >= 0; ) {
+        if (sp->nodes[t].key > key) {
+            count += 1 + tsize(sp, sp->nodes[t].right);
+            t = sp->nodes[t].left;
+        } else {
+            t = sp->nodes[t].right;
+        }
+    }
+    return count;
+}
+
+void tinsert(sampler* sp, int n) {
+    int l, r;
+    tsplit(sp, sp->root, sp->nodes[n].key, &l, &r);
+    sp->root = tmerge(sp, tmerge(sp, l, n), r);
+}
+
+void tremove(sampler* sp, long key) {
+    int l, m, r, gone;
+    tsplit(sp, sp->root, key - 1, &l, &m);
+    tsplit(sp, m, key, &gone, &r);
+    sp->root = tmerge(sp, l, r);
+}
+
+int tnew(sampler* sp, unsigned long block, long key) {
+    int n;
+    if (sp->freelist >= 0) {
+        n = sp->freelist;
+        sp->freelist = sp->nodes[n].left;
+    } else {
+        if (sp->nnodes == sp->nodecap) {
+            sp->nodecap = sp->nodecap ? 2 * sp->nodecap : 1024;
+            sp->nodes = realloc(sp->nodes, sp->nodecap * sizeof(tnode));
+        }
+        n = (int) sp->nnodes++;
+    }
+    sp->nodes[n].key = key;
+    sp->nodes[n].block = block;
+    sp->nodes[n].prio = (unsigned int) rand();
+    sp->nodes[n].left = sp->nodes[n].right = -1;
+    sp->nodes[n].size = 1;
+    return n;
+}
+
+sampler* make_sampler(int b, double rate, long smax) {
+    sampler *sp = calloc(1, sizeof(sampler));
+    sp->b = b;
+    sp->threshold = (long) ceil(rate * SHARDS_MOD);
+    sp->smax = smax;
+    sp->where = addrmap_new(1024);
+    sp->root = sp->freelist = -1;
+    sp->hist = calloc(HIST_BINS, sizeof(double));
+    if (smax > 0) sp->heap = malloc((smax + 1) * sizeof(long));
+    return sp;
+}
+
+void free_sampler(sampler* sp) {
+    addrmap_free(sp->where);
+    free(sp->nodes);
+    free(sp->heap);
+    free(sp->hist);
+    free(sp);
+}
+
+/* heap helpers order tracked nodes by the hash of their block */
+unsigned long nodehash(sampler* sp, long n) {
+    return blockhash(sp->nodes[n].block);
+}
+
+void heappush(sampler* sp, long n) {
+    long i = sp->heaplen++;
+    while (i > 0 && nodehash(sp, sp->heap[(i - 1) / 2]) < nodehash(sp, n)) {
+        sp->heap[i] = sp->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sp->heap[i] = n;
+}
+
+long heappop(sampler* sp) {
+    long top = sp->heap[0];
+    long last = sp->heap[--sp->heaplen];
+    long i = 0;
+    while (2 * i + 1 < sp->heaplen) {
+        long c = 2 * i + 1;
+        if (c + 1 < sp->heaplen
+            && nodehash(sp, sp->heap[c + 1]) > nodehash(sp, sp->heap[c])) c++;
+        if (nodehash(sp, sp->heap[c]) <= nodehash(sp, last)) break;
+        sp->heap[i] = sp->heap[c];
+        i = c;
+    }
+    sp->heap[i] = last;
+    return top;
+}
+
+/* shrink lowers the threshold until at most smax blocks are tracked */
+void shrink(sampler* sp) {
+    while ((long) addrmap_size(sp->where) > sp->smax) {
+        long n = heappop(sp);
+        sp->threshold = (long) nodehash(sp, n);
+        addrmap_remove(sp->where, sp->nodes[n].block);
+        tremove(sp, sp->nodes[n].key);
+        sp->nodes[n].left = sp->freelist;
+        sp->freelist = (int) n;
+        /* blocks sharing that hash go too, as they are no longer sampled */
+        while (sp->heaplen > 0
+               && nodehash(sp, sp->heap[0]) >= (unsigned long) sp->threshold) {
+            n = heappop(sp);
+            addrmap_remove(sp->where, sp->nodes[n].block);
+            tremove(sp, sp->nodes[n].key);
+            sp->nodes[n].left = sp->freelist;
+            sp->freelist = (int) n;
+        }
+    }
+}
+
+/* sample processes the access at time t if its block is sampled */
+void sample(sampler* sp, unsigned long address, long t) {
+    unsigned long block = address >> sp->b;
+    double rate;
+
+    if ((long) blockhash(block) >= sp->threshold) return;
+    rate = (double) sp->threshold / SHARDS_MOD;
+    sp->total += 1 / rate;
+
+    long *where = addrmap_get(sp->where, block);
+    if (where == NULL) {
+        sp->cold += 1 / rate;
+        int n = tnew(sp, block, t);
+        tinsert(sp, n);
+        *addrmap_put(sp->where, block, 0) = n;
+        if (sp->smax > 0) {
+            heappush(sp, n);
+            shrink(sp);
+        }
+        return;
+    }
+
+    int n = (int) *where;
+    long dist = (long) (tafter(sp, sp->nodes[n].key) / rate);
+    while ((dist >> sp->shift) >= HIST_BINS) {
+        /* coarsen: merge pairs of bins */
+        for (long k = 0; k < HIST_BINS / 2; k++) {
+            sp->hist[k] = sp->hist[2 * k] + sp->hist[2 * k + 1];
+        }
+        memset(sp->hist + HIST_BINS / 2, 0, HIST_BINS / 2 * sizeof(double));
+        sp->shift++;
+    }
+    sp->hist[dist >> sp->shift] += 1 / rate;
+    tremove(sp, sp->nodes[n].key);
+    sp->nodes[n].key = t;
+    sp->nodes[n].left = sp->nodes[n].right = -1;
+    sp->nodes[n].size = 1;
+    tinsert(sp, n);
+}
+
+/* sampledratio estimates the miss ratio of a cache of c blocks,
+ * interpolating within the histogram bin that straddles c */
+double sampledratio(sampler* sp, long c) {
+    double hits = 0;
+    long width = 1L << sp->shift;
+    for (long k = 0; k < HIST_BINS && k * width < c; k++) {
+        long hi = (k + 1) * width;
+        hits += sp->hist[k] * (hi <= c ? 1.0 : (double) (c - k * width) / width);
+    }
+    return sp->total > 0 ? 1.0 - hits / sp->total : 0.0;
+}
+
+/* emitsampled writes rows for powers of two up to the estimated number
+ * of distinct blocks */
+void emitsampled(FILE* out, sampler* sp) {
+    for (long c = 1; c / 2 < (long) sp->cold; c *= 2) {
+        fprintf(out, "%ld,%ld,%ld,%.6f\n", 1L << sp->b, c, c << sp->b,
+                sampledratio(sp, c));
+    }
+}
+
+/* compare reports how far the sampled curve is from the exact one */
+void compare(sampler* sp, analyzer* an) {
+    double sum = 0, worst = 0;
+    int points = 0;
+    long distinct = (long) addrmap_size(an->last);
+
+    for (long c = 1; c / 2 < distinct; c *= 2) {
+        double err = fabs(sampledratio(sp, c) - exactratio(an, c));
+        sum += err;
+        if (err > worst) worst = err;
+        points++;
+    }
+    fprintf(stderr, "block_bytes:%ld sampling_rate:%.6f tracked_blocks:%zu "
+            "mean_abs_error:%.6f max_abs_error:%.6f\n",
+            1L << sp->b, (double) sp->threshold / SHARDS_MOD,
+            addrmap_size(sp->where), points ? sum / points : 0.0, worst);
+}
+
+/* emitcurve writes one CSV row per cache size: every size from 1 block
+ * up to the number of distinct blocks if all is set, otherwise the
+ * powers of two up to the first size that holds every block */
+void emitcurve(FILE* out, analyzer* an, int all) {
+    long distinct = (long) addrmap_size(an->last);
+    long misses = an->total;   /* a zero-block cache misses everything */
+    long limit = distinct;
+
+    if (!all) {
+        for (limit = 1; limit < distinct; limit *= 2)
+            ;
+    }
+    for (long c = 1; c <= limit; c++) {
+        /* a cache of c blocks also hits the accesses at distance c - 1 */
+        if (c - 1 < an->histlen) misses -= an->hist[c - 1];
+        if (all || (c & (c - 1)) == 0) {
+            fprintf(out, "%ld,%ld,%ld,%.6f\n", 1L << an->b, c, c << an->b,
+                    an->total ? (double) misses / an->total : 0.0);
+        }
+    }
+}
+
+static void usage(char* cmd) {
+    fprintf(stderr, "Usage: %s [-h] [-a] [-b lo[-hi]] [-o out.csv] "
+            "[-R rate [-m max] [-e]] -t <trace>\n", cmd);
+    fprintf(stderr, "  -t <trace>   Text or binary trace file (- for stdin)\n");
+    fprintf(stderr, "  -b lo[-hi]   log2 block size, or a range (default 6)\n");
+    fprintf(stderr, "  -a           Emit every cache size, not just powers of two\n");
+    fprintf(stderr, "  -o <file>    Write the CSV there instead of stdout\n");
+    fprintf(stderr, "  -R <rate>    SHARDS: sample this fraction of blocks\n");
+    fprintf(stderr, "  -m <max>     SHARDS: track at most max blocks\n");
+    fprintf(stderr, "  -e           SHARDS: also run exactly and report the error\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    char *trace_name = NULL;
+    char *out_name = NULL;
+    int blo = 6, bhi = 6;
+    int all = 0;
+    double rate = 0;
+    long smax = 0;
+    int check = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "ht:b:ao:R:m:e")) != -1) {
+        switch (c) {
+        case 't':
+            trace_name = optarg;
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d-%d", &blo, &bhi) == 1) bhi = blo;
+            if (blo < 0 || bhi < blo || bhi > 40) usage(argv[0]);
+            break;
+        case 'a':
+            all = 1;
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'R':
+            rate = atof(optarg);
+            if (rate <= 0 || rate > 1) usage(argv[0]);
+            break;
+        case 'm':
+            smax = atol(optarg);
+            break;
+        case 'e':
+            check = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (trace_name == NULL || ((smax > 0 || check) && rate == 0)) {
+        usage(argv[0]);
+    }
+
+    trace_t *traces = trace_open(trace_name);
+    if (traces == NULL) {
+        fprintf(stderr, "Cannot open trace file %s\n", trace_name);
+        exit(1);
+    }
+    int nan = bhi - blo + 1;
+    FILE *out = out_name ? fopen(out_name, "w") : stdout;
+    if (out == NULL) {
+        perror(out_name);
+        exit(1);
+    }
+    fprintf(out, "block_bytes,cache_blocks,cache_bytes,miss_ratio\n");
+
+    /* sampling streams the trace unless it is checked against the
+     * exact analysis, which needs the trace length up front */
+    if (rate > 0 && !check) {
+        const trace_rec_t *rec;
+        long t = 0;
+        sampler **sps = malloc(nan * sizeof(sampler*));
+        for (int i = 0; i < nan; i++) {
+            sps[i] = make_sampler(blo + i, rate, smax);
+        }
+        while ((rec = trace_next(traces)) != NULL) {
+            t++;
+            for (int i = 0; i < nan; i++) {
+                sample(sps[i], rec->addr, t);
+            }
+        }
+        trace_close(traces);
+        for (int i = 0; i < nan; i++) {
+            emitsampled(out, sps[i]);
+            free_sampler(sps[i]);
+        }
+        free(sps);
+        if (out != stdout) fclose(out);
+        return 0;
+    }
+
+    /* the Fenwick tree needs the trace length up front */
+    long n = -1;
+    const trace_rec_t *recs = trace_load(traces, &n);
+    if (recs == NULL && n != 0) {
+        fprintf(stderr, "Out of memory loading the trace\n");
+        exit(1);
+    }
+    if (n > UINT_MAX) {
+        fprintf(stderr, "Trace too long for exact analysis\n");
+        exit(1);
+    }
+
+    analyzer **ans = malloc(nan * sizeof(analyzer*));
+    sampler **sps = calloc(nan, sizeof(sampler*));
+    for (int i = 0; i < nan; i++) {
+        ans[i] = make_analyzer(blo + i, n);
+        if (check) sps[i] = make_sampler(blo + i, rate, smax);
+    }
+    for (long t = 0; t < n; t++) {
+        for (int i = 0; i < nan; i++) {
+            analyze(ans[i], recs[t].addr, t + 1);
+            if (check) sample(sps[i], recs[t].addr, t + 1);
+        }
+    }
+    trace_close(traces);
+
+    for (int i = 0; i < nan; i++) {
+        if (check) {
+            /* the sampled curve is the output; the exact one is the yardstick */
+            emitsampled(out, sps[i]);
+            compare(sps[i], ans[i]);
+            free_sampler(sps[i]);
+        } else {
+            emitcurve(out, ans[i], all);
+        }
+        free_analyzer(ans[i]);
+    }
+    free(ans);
+    free(sps);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -2,262 +2,1350 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <limits.h>
 #include "cachelab.h"
+#include "cachemodel.h"
 
-/* represents a cache line, where usecount is the indicator for when the
- * block was used */
-typedef struct {
-    int valid;
-    long tag;
-    int block;
-    int usecount; /* tells which operation used the line */
-    int isdirty; /* tell whether the line is dirty */
-} cache_line;
-
-/* represents a set */
-typedef struct {
-    cache_line* lines;
-} cache_set;
+/* printprefetch reports a prefetcher apart from the demand counters.
+ * Accuracy is the share of prefetches that were used, coverage the
+ * share of would-be misses they removed */
+void printprefetch(config* cfg) {
+    prefetch_state *ps = cfg->pf;
+    printf("prefetch:%s issued:%ld useful:%ld useless:%ld pollution:%ld "
+           "evictions:%ld accuracy:%.3f coverage:%.3f\n", ps->pf->name,
+           ps->issued, ps->useful, ps->useless, ps->pollution, ps->evict,
+           ps->issued ? (double) ps->useful / ps->issued : 0.0,
+           ps->useful + cfg->miss
+               ? (double) ps->useful / (ps->useful + cfg->miss) : 0.0);
+}
 
-/* represents a whole cache */
-typedef struct {
-    cache_set* sets;
-} cache;
+/*
+ * Multi-level hierarchy (-L per level, L1 first).  Misses fetch the
+ * block from the next level down and dirty victims are written back to
+ * it.  The inclusion policy decides what else moves between levels:
+ *   NINE       levels are filled independently and never invalidated
+ *   inclusive  a line evicted from a level is invalidated in every
+ *              level above it (counted as back invalidations)
+ *   exclusive  a block lives in one level at a time: a hit below moves
+ *              the block up, and every victim, clean or dirty, drops
+ *              into the next level
+ */
+#define INCL_NINE 0
+#define INCL_INCLUSIVE 1
+#define INCL_EXCLUSIVE 2
+
+/* backinvalidate removes [address, address + 2^b) from levels above */
+void backinvalidate(config** levels, int level, unsigned long address) {
+    unsigned long size = 1UL << levels[level]->ourdim->b;
+    for (int i = 0; i < level; i++) {
+        int b = levels[i]->ourdim->b;
+        unsigned long a = address >> b << b;
+        for (; a < address + size; a += 1UL << b) {
+            int dirty;
+            if (invalidate(levels[i], a, &dirty)) {
+                /* leaving the hierarchy: dirty data goes to memory */
+                levels[i]->backinval++;
+                levels[i]->ourdim->devicted += dirty;
+            }
+        }
+    }
+}
+
+/* hieraccess sends an operation to one level and whatever it causes to
+ * the levels below */
+void hieraccess(config** levels, int nlevels, int level, int inclusion,
+                char op, unsigned long address, unsigned int size,
+                long opnum) {
+    config *cfg = levels[level];
+    evicted_line ev;
+    int below = level + 1 < nlevels;
+    int hit = simulate(cfg, op, address, size, opnum, &ev);
+
+    if (inclusion == INCL_EXCLUSIVE) {
+        if (hit) return;
+        /* pull the block up from the first level below that has it */
+        for (int i = level + 1; i < nlevels; i++) {
+            int dirty;
+            if (probe(levels[i], address, &dirty)) {
+                if (dirty) {
+                    long setindex, addrtag;
+                    cache_set *set = locate(cfg, address, &setindex, &addrtag);
+                    int victim;
+                    int line = lookup(set, addrtag, cfg->ourdim->E, &victim);
+                    /* the miss filled the block unless the store bypassed
+                     * the cache (-n), which leaves nothing to mark */
+                    if (line >= 0) markdirty(cfg, set, line);
+                }
+                break;
+            }
+            /* missing everywhere, it is read from memory */
+            if (i == nlevels - 1) {
+                levels[i]->bytesread += 1L << levels[i]->ourdim->b;
+            }
+        }
+        /* then let the victim trickle down */
+        for (int i = level + 1; ev.valid && i < nlevels; i++) {
+            /* dirty victims already count as dirty evictions */
+            if (!ev.dirty) {
+                levels[i - 1]->byteswritten += 1L << levels[i - 1]->ourdim->b;
+            }
+            insert(levels[i], ev.address, ev.dirty, opnum, &ev);
+        }
+        return;
+    }
+
+    if (!hit && below) {
+        hieraccess(levels, nlevels, level + 1, inclusion, 'L', address,
+                   1U << cfg->ourdim->b, opnum);
+    }
+    if (ev.valid) {
+        if (ev.dirty && below) {
+            hieraccess(levels, nlevels, level + 1, inclusion, 'S',
+                       ev.address, 1U << cfg->ourdim->b, opnum);
+        }
+        if (inclusion == INCL_INCLUSIVE && level > 0) {
+            backinvalidate(levels, level, ev.address);
+        }
+    }
+}
+
+/* fetch sends an instruction fetch to the L1I cache (-i); its misses
+ * go to the unified level below L1D, if there is one */
+void fetch(config* icache, config** levels, int nlevels, int inclusion,
+           const trace_rec_t* rec, int sized, long opnum) {
+    long n = pieces(icache, rec->addr, rec->size, sized);
+    for (long k = 0; k < n; k++) {
+        unsigned long address = piece(icache, rec->addr, k);
+        if (!simulate(icache, 'I', address,
+                      piecebytes(icache, rec->addr, rec->size, n, k),
+                      opnum, NULL)
+            && nlevels > 1) {
+            hieraccess(levels, nlevels, 1, inclusion, 'L', address,
+                       1U << icache->ourdim->b, opnum);
+        }
+    }
+}
+
+/* parserange reads "n" or "lo-hi" into [lo, hi] and returns the end of
+ * the field, or NULL if the field is malformed */
+char* parserange(char* field, int* lo, int* hi) {
+    char *end;
+    *lo = (int) strtol(field, &end, 10);
+    *hi = *lo;
+    if (end == field) return NULL;
+    if (*end == '-') {
+        field = end + 1;
+        *hi = (int) strtol(field, &end, 10);
+        if (end == field || *hi < *lo) return NULL;
+    }
+    return end;
+}
+
+/* addgeometries expands a sweep spec "s:E:b", where each field is "n" or
+ * "lo-hi", and appends every point of the product to geoms.  Returns
+ * the new number of geometries, or -1 on a malformed spec. */
+int addgeometries(char* spec, int (**geoms)[3], int ngeoms) {
+    int lo[3], hi[3];
+    char *field = spec;
+
+    for (int k = 0; k < 3; k++) {
+        field = parserange(field, &lo[k], &hi[k]);
+        if (field == NULL || *field != (k < 2 ? ':' : '\0')) {
+            fprintf(stderr, "Invalid geometry \"%s\", expected s:E:b\n", spec);
+            return -1;
+        }
+        field++;
+    }
 
-/* represents dirty evicted/cached counter, as well as dimension of cache */
+    for (int s = lo[0]; s <= hi[0]; s++) {
+        for (int E = lo[1]; E <= hi[1]; E++) {
+            for (int b = lo[2]; b <= hi[2]; b++) {
+                *geoms = realloc(*geoms, sizeof(**geoms) * (ngeoms + 1));
+                (*geoms)[ngeoms][0] = s;
+                (*geoms)[ngeoms][1] = E;
+                (*geoms)[ngeoms][2] = b;
+                ngeoms++;
+            }
+        }
+    }
+    return ngeoms;
+}
+
+/* addlevel parses a hierarchy level "s:E:b[:policy]" into levels; a
+ * level that names no policy gets dflt (lru below L1 if dflt is opt).
+ * Returns the new number of levels, or -1 on a malformed spec. */
+int addlevel(char* spec, config*** levels, int nlevels, policy* dflt) {
+    int s, E, b, n = 0;
+    policy *pol = dflt;
+
+    if (sscanf(spec, "%d:%d:%d%n", &s, &E, &b, &n) != 3
+        || (spec[n] != '\0' && spec[n] != ':')) {
+        fprintf(stderr, "Invalid level \"%s\", expected s:E:b[:policy]\n", spec);
+        return -1;
+    }
+    if (nlevels > 0 && strcmp(pol->name, "opt") == 0) pol = &policies[0];
+    if (spec[n] == ':') {
+        pol = findpolicy(spec + n + 1);
+        if (pol == NULL || (nlevels > 0 && strcmp(pol->name, "opt") == 0)) {
+            fprintf(stderr, "Invalid policy for level %d: %s%s\n", nlevels + 1,
+                    spec + n + 1, pol ? " (opt only applies to L1)" : "");
+            return -1;
+        }
+    }
+    if (checkdim(s, E, b, pol) < 0) return -1;
+    *levels = realloc(*levels, sizeof(config*) * (nlevels + 1));
+    (*levels)[nlevels] = make_config(s, E, b, pol);
+    return nlevels + 1;
+}
+
+/* printrow prints one printSummary-style line of a sweep */
+void printrow(config* cfg) {
+    dim *ourdim = cfg->ourdim;
+    printf("s:%d E:%d b:%d ", ourdim->s, ourdim->E, ourdim->b);
+    printf("hits:%ld misses:%ld evictions:%ld dirty_bytes_in_cache:%ld dirty_bytes_evicted:%ld",
+           cfg->hit, cfg->miss, cfg->evict,
+           ourdim->dcached << ourdim->b, ourdim->devicted << ourdim->b);
+    printf(" bytes_read:%ld bytes_written:%ld\n", cfg->bytesread,
+           cfg->byteswritten + (ourdim->devicted << ourdim->b));
+}
+
+/* printclasses prints the three-C breakdown of a configuration's misses,
+ * with the conflict misses of every set that had any if persets */
+void printclasses(config* cfg, int persets) {
+    classifier *cl = cfg->classes;
+    printf("compulsory:%ld capacity:%ld conflict:%ld\n",
+           cl->compulsory, cl->capacitymiss, cl->conflict);
+    for (long i = 0; persets && i < (1L << cfg->ourdim->s); i++) {
+        if (cl->setconflict[i] > 0) {
+            printf("set:%ld conflict:%ld\n", i, cl->setconflict[i]);
+        }
+    }
+}
+
+/* writeheatmap appends a configuration's heatmap rows to a CSV file */
+void writeheatmap(FILE* out, config* cfg, int level) {
+    heatmap *heat = cfg->heat;
+    long i;
+    for (i = 0; i < (1L << cfg->ourdim->s); i++) {
+        fprintf(out, "L%d,set,%ld,%ld,%ld,%ld\n", level, i, heat->sets[i][0],
+                heat->sets[i][1], heat->sets[i][2]);
+    }
+    for (i = 0; i < heat->nregions; i++) {
+        fprintf(out, "L%d,region,0x%lx,%ld,%ld,%ld\n", level,
+                heat->regionids[i] << heat->regionbits,
+                heat->regionstats[i][0], heat->regionstats[i][1],
+                heat->regionstats[i][2]);
+    }
+}
+
+/*
+ * Multicore coherence (several -t, one per core).  Every core has a
+ * private cache of the same geometry, the traces are interleaved one
+ * access per core in turn, and a snooping bus keeps the caches coherent
+ * with MESI, or MOESI (-m), where a modified line that another core
+ * reads becomes Owned instead of being written back.  Stores and
+ * modifies are writes; a write to a line another core holds invalidates
+ * it there.  A later miss of that core on the block is a coherence
+ * miss, and a false sharing one if no word it touches was written by
+ * another core since the invalidation.
+ */
+#define COH_S 1
+#define COH_E 2
+#define COH_O 3
+#define COH_M 4
+
+#define COH_MESI 0
+#define COH_MOESI 1
+
+/* represents the protocol, the blocks each core lost to invalidations
+ * (with the words other cores wrote since) and per-block counters */
 typedef struct {
-    int s;
-    int E;
-    int b;
-    int devicted;
-    int dcached;
-} dim;
-
-cache* make_cache(dim* ourdim) {
-    int s = ourdim->s;
-    int E = ourdim->E;
-
-    int S = 1 << s;
-    cache *new_cache = (cache*) malloc(sizeof(cache));
-    new_cache->sets = (cache_set*) malloc(sizeof(cache_set) * S);
-    cache_line *current_line;
-
-    /* now for each set, we create lines */
-    for (int i = 0; i < S; i ++) {
-	    new_cache->sets[i].lines = malloc(sizeof(cache_line) * E);
-	    current_line = new_cache->sets[i].lines;
-        for (int j = 0; j < E; j ++) {
-            current_line[j].valid = 0;
-    	    current_line[j].tag = 0;
-            current_line[j].block = 0;
-            current_line[j].usecount = 0;
-            current_line[j].isdirty = 0;
-        }
-    }
-
-    return new_cache;
-}
-
-/* free my cache */
-void freecache(cache* our_cache, dim* ourdim) {
-    free(ourdim);
-    free(our_cache->sets->lines);
-    free(our_cache->sets);
-    free(our_cache);
-    return;
-}
-
-/* isHit returns 1 when an op hits, 0 when it misses, and -1 when evicted */
-int isHit (cache_set* targetset, long addrtag, dim* ourdim, int opnum) {
-    cache_line *targetline = targetset->lines;
-    int max_lines = ourdim->E;
-    int checkfull = 0 ;/* counter to check whether a set is full or not */
-
-    /* now check all lines in a set */
-    for (int i = 0; i < max_lines; i++) {
-    	if (targetline[i].tag == addrtag) {
-            if (targetline[i].valid == 1) {
-                targetline[i].usecount = opnum;
-                return 1;
+    int protocol;
+    int ncores;
+    addrmap_t** lost;   /* per core: lost block -> mask of words written */
+    addrmap_t* blocks;  /* block -> its row in stats */
+    long (*stats)[3];   /* invalidations, coherence misses, false sharing */
+    unsigned long* blockids;
+    long nblocks;
+    long invalidations;
+    long cohmisses;
+    long falsesharing;
+    long transfers;     /* misses served by another core's dirty copy */
+} coherence;
+
+coherence* make_coherence(int protocol, int ncores) {
+    coherence *co = (coherence*) calloc(1, sizeof(coherence));
+    co->protocol = protocol;
+    co->ncores = ncores;
+    co->lost = (addrmap_t**) malloc(ncores * sizeof(addrmap_t*));
+    for (int c = 0; c < ncores; c++) {
+        co->lost[c] = addrmap_new(256);
+    }
+    co->blocks = addrmap_new(256);
+    return co;
+}
+
+void freecoherence(coherence* co) {
+    for (int c = 0; c < co->ncores; c++) {
+        addrmap_free(co->lost[c]);
+    }
+    free(co->lost);
+    addrmap_free(co->blocks);
+    free(co->stats);
+    free(co->blockids);
+    free(co);
+}
+
+/* blockstats returns the counters of a block, adding a row if needed */
+long* blockstats(coherence* co, unsigned long block) {
+    long *row = addrmap_get(co->blocks, block);
+    if (row != NULL) return co->stats[*row];
+
+    if ((co->nblocks & (co->nblocks - 1)) == 0) {
+        long cap = co->nblocks ? 2 * co->nblocks : 1;
+        co->stats = realloc(co->stats, cap * sizeof(*co->stats));
+        co->blockids = realloc(co->blockids, cap * sizeof(unsigned long));
+    }
+    memset(co->stats[co->nblocks], 0, sizeof(*co->stats));
+    co->blockids[co->nblocks] = block;
+    *addrmap_put(co->blocks, block, 0) = co->nblocks;
+    return co->stats[co->nblocks++];
+}
+
+/* findline returns the line of a core's cache holding address, or -1 */
+int findline(config* cfg, unsigned long address, cache_set** set) {
+    long setindex, addrtag;
+    int victim;
+    *set = locate(cfg, address, &setindex, &addrtag);
+    return lookup(*set, addrtag, cfg->ourdim->E, &victim);
+}
+
+/* wordmask returns the 8-byte words of its block that an access covers,
+ * one bit per word (modulo 64 for blocks over 512 bytes) */
+long wordmask(int b, unsigned long address, unsigned int size) {
+    unsigned long first = (address & ((1UL << b) - 1)) >> 3;
+    unsigned long last = ((address & ((1UL << b) - 1)) + (size ? size : 1) - 1)
+                         >> 3;
+    unsigned long mask = 0;
+
+    if (last > ((1UL << b) - 1) >> 3) last = ((1UL << b) - 1) >> 3;
+    if (last - first >= 63) return -1;
+    for (unsigned long w = first; w <= last; w++) {
+        mask |= 1UL << (w & 63);
+    }
+    return (long) mask;
+}
+
+/* snoopwrite invalidates every other copy of a block written by core c.
+ * On a write miss, a dirty copy supplies the data (and under MESI is
+ * written back to memory on the way, as on a read) */
+void snoopwrite(config** cores, coherence* co, int c, unsigned long address,
+                long word, int missed) {
+    unsigned long block = address >> cores[c]->ourdim->b;
+    for (int d = 0; d < co->ncores; d++) {
+        int dirty;
+        long *mask;
+        if (d == c) continue;
+        if (invalidate(cores[d], address, &dirty)) {
+            co->invalidations++;
+            blockstats(co, block)[0]++;
+            if (dirty && missed) {
+                co->transfers++;
+                if (co->protocol == COH_MESI) cores[d]->ourdim->devicted++;
             }
-	    }
-	    checkfull += (targetline[i].valid);
-    }
-    /* set is full when all lines are valid */
-    if (checkfull == max_lines) {
-	    return -1;
-    } else { /*when set is not full, then miss */
-        return 0;
-    }
-}
-
-/* updatecache updates a cache after a trace */
-void updatecache (cache_set* targetset, long addrtag, dim* ourdim, int opnum,
-                  int didHit) {
-    cache_line *targetline = targetset->lines;
-    int max_lines = ourdim->E;
-    /* if hit, return */
-    if (didHit == 1) return;
-
-    /* if miss and not full, then update */
-    if (didHit == 0) {
-        for (int i = 0; i < max_lines; i++) {
-            if (targetline[i].valid == 0) {
-                targetline[i].tag = addrtag;
-                targetline[i].valid = 1;
-                targetline[i].usecount = opnum;
-                return;
+            *addrmap_put(co->lost[d], block, 0) = word;
+        } else if ((mask = addrmap_get(co->lost[d], block)) != NULL) {
+            *mask |= word;
+        }
+    }
+}
+
+/* coheraccess runs one access of core c through the private caches */
+void coheraccess(config** cores, coherence* co, int c, char op,
+                 unsigned long address, unsigned int size, long opnum) {
+    config *cfg = cores[c];
+    int b = cfg->ourdim->b;
+    unsigned long block = address >> b;
+    long word = wordmask(b, address, size);
+    int write = (op == 'S' || op == 'M');
+    long setindex, addrtag;
+    cache_set *set = locate(cfg, address, &setindex, &addrtag);
+    int victim;
+    int line = lookup(set, addrtag, cfg->ourdim->E, &victim);
+
+    if (line >= 0) {
+        cfg->hit++;
+        cfg->policy->touch(cfg, set, line, opnum, 0);
+        /* E and M already exclusive; S and O must upgrade on the bus */
+        if (write && set->state[line] != COH_E && set->state[line] != COH_M) {
+            snoopwrite(cores, co, c, address, word, 0);
+        }
+    } else {
+        long *mask = addrmap_get(co->lost[c], block);
+        int shared = 0;
+
+        cfg->miss++;
+        if (mask != NULL) {
+            long *row = blockstats(co, block);
+            co->cohmisses++;
+            row[1]++;
+            if ((*mask & word) == 0) {
+                co->falsesharing++;
+                row[2]++;
             }
+            addrmap_remove(co->lost[c], block);
         }
+
+        if (write) {
+            snoopwrite(cores, co, c, address, word, 1);
+        } else {
+            for (int d = 0; d < co->ncores; d++) {
+                cache_set *other;
+                int l;
+                if (d == c || (l = findline(cores[d], address, &other)) < 0) {
+                    continue;
+                }
+                shared = 1;
+                if (other->state[l] == COH_M || other->state[l] == COH_O) {
+                    co->transfers++;
+                }
+                if (other->state[l] == COH_M && co->protocol == COH_MESI) {
+                    /* written back to memory on the way */
+                    cores[d]->ourdim->devicted++;
+                    cores[d]->ourdim->dcached--;
+                    other->isdirty[l] = 0;
+                    other->state[l] = COH_S;
+                } else if (other->state[l] == COH_M) {
+                    other->state[l] = COH_O;
+                } else if (other->state[l] == COH_E) {
+                    other->state[l] = COH_S;
+                }
+            }
+        }
+        line = fill(cfg, set, setindex, addrtag, victim, opnum, NULL);
+        cfg->bytesread += 1L << b;
+        set->state[line] = shared ? COH_S : COH_E;
+    }
+
+    if (write) {
+        set->state[line] = COH_M;
+        markdirty(cfg, set, line);
     }
+}
+
+/* simulatecoherent interleaves the per-core traces, one access each in
+ * turn, until all of them are exhausted */
+void simulatecoherent(config** cores, coherence* co, trace_t** traces,
+                      int sized) {
+    const trace_rec_t *rec;
+    long opnum = 0;
+    int active = co->ncores;
+    char *done = (char*) calloc(co->ncores, sizeof(char));
 
-    /* if miss and full, then evict and update */
-    /* first, find what should be evicted */
-    int lru = opnum;
-    int lru_line;
-    if (didHit == -1) {
-        for (int j = 0; j < max_lines; j++) {
-            if (targetline[j].usecount < lru) {
-                lru = targetline[j].usecount;
-	        lru_line = j;
+    while (active > 0) {
+        for (int c = 0; c < co->ncores; c++) {
+            if (done[c]) continue;
+            if ((rec = trace_next(traces[c])) == NULL) {
+                done[c] = 1;
+                active--;
+                continue;
             }
+            long n = pieces(cores[c], rec->addr, rec->size, sized);
+            for (long k = 0; k < n; k++) {
+                coheraccess(cores, co, c, rec->op,
+                            piece(cores[c], rec->addr, k),
+                            piecebytes(cores[c], rec->addr, rec->size, n, k),
+                            opnum);
+            }
+            opnum++;
         }
     }
+    free(done);
+}
 
-    /* now, evict the LRU line and change values */
-    cache_line *lruline = &targetline[lru_line];
-    lruline->valid = 1;
-    lruline->usecount = opnum;
-    lruline->tag = addrtag;
-    return;
+/* comparerows orders block rows by coherence misses, then invalidations */
+static long (*sortstats)[3];
+
+int comparerows(const void* x, const void* y) {
+    long *a = sortstats[*(const long*) x];
+    long *b = sortstats[*(const long*) y];
+    if (a[1] != b[1]) return a[1] < b[1] ? 1 : -1;
+    if (a[0] != b[0]) return a[0] < b[0] ? 1 : -1;
+    return 0;
+}
+
+/* printcoherence prints the totals, then one line per block that saw
+ * invalidations, worst first */
+void printcoherence(coherence* co) {
+    long *order = (long*) malloc(co->nblocks * sizeof(long));
+    long i;
+
+    printf("coherence:%s invalidations:%ld coherence_misses:%ld "
+           "false_sharing:%ld transfers:%ld\n",
+           co->protocol == COH_MOESI ? "moesi" : "mesi", co->invalidations,
+           co->cohmisses, co->falsesharing, co->transfers);
+    for (i = 0; i < co->nblocks; i++) {
+        order[i] = i;
+    }
+    sortstats = co->stats;
+    qsort(order, co->nblocks, sizeof(long), comparerows);
+    for (i = 0; i < co->nblocks; i++) {
+        long *row = co->stats[order[i]];
+        printf("block:0x%lx invalidations:%ld coherence_misses:%ld "
+               "false_sharing:%ld\n", co->blockids[order[i]], row[0], row[1],
+               row[2]);
+    }
+    free(order);
 }
 
-/* markdirty marks the isdirty bit when necessary,
- * as well as changes dirtybytes values */
-void markdirty (cache_set* targetset, long addrtag, dim* ourdim, int opnum,
-                char op, int didHit) {
-    int max_lines = ourdim->E;
-    int wasdirty;
-    cache_line *targetline;
+/*
+ * TLB (-T entries:assoc:pagebits).  Every access is translated before
+ * it reaches the data cache.  The TLB is the cache model again, with
+ * pages for blocks and LRU replacement.  A TLB miss walks an x86-64
+ * style radix page table, 9 bits a level over 48-bit virtual
+ * addresses: four levels for 4 KB pages, three for 2 MB pages.  Each
+ * level read is one page-walk memory access.  The optional page-walk
+ * cache (-K entries, fully associative) keeps the upper-level entries
+ * of recent walks, and a walk starts below the deepest one it finds.
+ * Translation is the identity, so the data cache sees the same
+ * addresses with or without -T.
+ */
+#define VA_BITS 48
+#define PT_LEVELBITS 9
 
-    /* first, find what which line needs to be modified using opnum */
-    for (int i = 0; i < max_lines; i++) {
-        if (targetset->lines[i].usecount == opnum) {
-            wasdirty = targetset->lines[i].isdirty;
-            targetline = &(targetset->lines[i]);
+/* represents the TLB, the page-walk cache and the walk counters */
+typedef struct {
+    config* tlb;
+    config* pwc;    /* -K only */
+    int levels;     /* page table levels a full walk reads */
+    long walkreads; /* page table entries read from memory */
+} mmu;
+
+mmu* make_mmu(char* spec, int pwcentries) {
+    int entries, assoc, pagebits, s = 0;
+    if (sscanf(spec, "%d:%d:%d", &entries, &assoc, &pagebits) != 3
+        || assoc < 1 || entries < assoc || entries % assoc != 0
+        || ((entries / assoc) & (entries / assoc - 1)) != 0
+        || pagebits < 1 || pagebits >= VA_BITS) {
+        fprintf(stderr, "-T takes entries:assoc:pagebits, with entries a "
+                "power of two multiple of assoc\n");
+        return NULL;
+    }
+    while ((1 << s) < entries / assoc) s++;
+    if (checkdim(s, assoc, pagebits, &policies[0]) < 0) return NULL;
+
+    mmu *m = (mmu*) calloc(1, sizeof(mmu));
+    m->tlb = make_config(s, assoc, pagebits, &policies[0]);
+    m->levels = (VA_BITS - pagebits + PT_LEVELBITS - 1) / PT_LEVELBITS;
+    if (pwcentries > 0) {
+        m->pwc = make_config(0, pwcentries, 0, &policies[0]);
+    }
+    return m;
+}
+
+void freemmu(mmu* m) {
+    freeconfig(m->tlb);
+    if (m->pwc != NULL) freeconfig(m->pwc);
+    free(m);
+}
+
+/* walk reads the page table entries missing from the page-walk cache.
+ * Level k (1 at the root) covers the address bits above shift, and its
+ * page-walk cache key is those bits tagged with the level */
+void walk(mmu* m, unsigned long address, long opnum) {
+    unsigned long va = address & ((1UL << VA_BITS) - 1);
+    int known = 0;
+    for (int k = m->levels - 1; m->pwc != NULL && k >= 1; k--) {
+        int shift = m->tlb->ourdim->b + PT_LEVELBITS * (m->levels - k);
+        unsigned long key = ((unsigned long) k << VA_BITS) | (va >> shift);
+        if (simulate(m->pwc, 'L', key, 1, opnum, NULL)) {
+            known = k;
+            break;
         }
     }
+    m->walkreads += m->levels - known;
+}
 
-    /* if it was a Save op */
-    if (op == 'S') {
-        targetline->isdirty = 1;
-        ourdim->dcached += (1 - wasdirty);
-        if (didHit < 1) {
-            ourdim->devicted += (wasdirty);
+/* translate looks up every page an access touches */
+void translate(mmu* m, const trace_rec_t* rec, int sized, long opnum) {
+    long n = pieces(m->tlb, rec->addr, rec->size, sized);
+    for (long k = 0; k < n; k++) {
+        unsigned long page = piece(m->tlb, rec->addr, k);
+        if (!simulate(m->tlb, 'L', page, 1, opnum, NULL)) {
+            walk(m, page, opnum);
         }
-    } else { /* if it's a Load op */
-        if (didHit < 1) {
-            targetline->isdirty = 0;
-            ourdim->dcached -= (wasdirty);
-            ourdim->devicted += (wasdirty);
+    }
+}
+
+/* printmmu reports the TLB; every TLB miss is one page walk */
+void printmmu(mmu* m, int sized) {
+    printf("tlb_hits:%ld tlb_misses:%ld tlb_evictions:%ld walk_reads:%ld",
+           m->tlb->hit, m->tlb->miss, m->tlb->evict, m->walkreads);
+    if (m->pwc != NULL) {
+        printf(" pwc_hits:%ld pwc_misses:%ld", m->pwc->hit, m->pwc->miss);
+    }
+    if (sized) printf(" page_splits:%ld", m->tlb->splits);
+    printf("\n");
+}
+
+/*
+ * Timeline (-e N).  The summary averages over the whole trace, which
+ * hides its phases, so every N trace records one CSV row describes the
+ * window that just ended: its hits, misses and evictions, its miss
+ * rate, its working set (the distinct blocks it touched) and the dirty
+ * lines in the cache when it ended.  A last, shorter window covers the
+ * rest of the trace.  With -L the rows are for L1; with -i, for L1D.
+ * Windows are counted in trace records, but accesses, like the hits and
+ * misses the miss rate is taken from, are the cache's own: instruction
+ * fetches are left out, and a split access or an M counts once per
+ * lookup.
+ */
+
+/* represents the window being filled and the counters at its start */
+typedef struct {
+    FILE* out;
+    long length;        /* trace records per window */
+    long window;        /* windows written so far */
+    long first;         /* opnum of the window's first record */
+    long hit, miss, evict;
+    addrmap_t* blocks;  /* blocks touched in this window */
+} timeline;
+
+timeline* make_timeline(char* name, long length) {
+    timeline *tl = (timeline*) calloc(1, sizeof(timeline));
+    tl->out = name != NULL ? fopen(name, "w") : stdout;
+    if (tl->out == NULL) {
+        perror(name);
+        exit(1);
+    }
+    tl->length = length;
+    tl->blocks = addrmap_new(1024);
+    fprintf(tl->out, "window,first_record,records,accesses,hits,misses,"
+            "evictions,miss_rate,working_set_blocks,dirty_lines\n");
+    return tl;
+}
+
+/* timelinetouch adds the blocks of an access to the window's working set */
+void timelinetouch(timeline* tl, config* cfg, const trace_rec_t* rec,
+                   int sized) {
+    long n = pieces(cfg, rec->addr, rec->size, sized);
+    for (long k = 0; k < n; k++) {
+        addrmap_put(tl->blocks, piece(cfg, rec->addr, k) >> cfg->ourdim->b, 0);
+    }
+}
+
+/* timelineflush writes the row of the window ending before opnum */
+void timelineflush(timeline* tl, config* cfg, long opnum) {
+    long hits = cfg->hit - tl->hit, misses = cfg->miss - tl->miss;
+
+    if (opnum == tl->first) return;
+    fprintf(tl->out, "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%.6f,%zu,%ld\n",
+            tl->window, tl->first, opnum - tl->first, hits + misses, hits,
+            misses, cfg->evict - tl->evict,
+            hits + misses > 0 ? (double) misses / (hits + misses) : 0.0,
+            addrmap_size(tl->blocks), cfg->ourdim->dcached);
+    tl->window++;
+    tl->first = opnum;
+    tl->hit = cfg->hit;
+    tl->miss = cfg->miss;
+    tl->evict = cfg->evict;
+    addrmap_clear(tl->blocks);
+}
+
+/* timelinetick ends the window once it holds length records */
+void timelinetick(timeline* tl, config* cfg, long opnum) {
+    if (opnum - tl->first == tl->length) timelineflush(tl, cfg, opnum);
+}
+
+void freetimeline(timeline* tl) {
+    if (tl->out != stdout) fclose(tl->out);
+    else fflush(stdout);
+    addrmap_free(tl->blocks);
+    free(tl);
+}
+
+/*
+ * Set-partitioned parallel mode (-j N).  Sets never interact under LRU,
+ * so each worker thread owns a contiguous slice of cache->sets.  The
+ * main thread reads the trace once and routes every access, tagged
+ * with its global opnum so LRU order is unchanged, to the queue of the
+ * worker owning its set.  Workers keep private counters that are
+ * merged at the end, so the counts match the serial path exactly.
+ */
+#define JOB_BATCH 4096 /* accesses handed over per queue operation */
+#define JOB_QDEPTH 8   /* batches a worker may have outstanding */
+
+/* represents a routed trace operation */
+typedef struct {
+    unsigned long address;
+    long opnum;
+    unsigned int size;
+    char op;
+} job;
+
+typedef struct {
+    job jobs[JOB_BATCH];
+    int njobs;
+} job_batch;
+
+/* represents a worker thread and its queue of batches */
+typedef struct {
+    pthread_t tid;
+    config cfg;          /* private counters; the cache is shared */
+    dim ourdim;
+    job_batch *queue[JOB_QDEPTH];
+    int head;
+    int count;
+    int done;            /* set once the trace is exhausted */
+    job_batch *filling;  /* batch the main thread is filling */
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    pthread_cond_t nonfull;
+} worker;
+
+void* workermain(void* arg) {
+    worker *w = (worker*) arg;
+    job_batch *batch;
+
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (w->count == 0 && !w->done) {
+            pthread_cond_wait(&w->nonempty, &w->lock);
+        }
+        if (w->count == 0) {
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
         }
+        batch = w->queue[w->head];
+        w->head = (w->head + 1) % JOB_QDEPTH;
+        w->count--;
+        pthread_cond_signal(&w->nonfull);
+        pthread_mutex_unlock(&w->lock);
+
+        for (int i = 0; i < batch->njobs; i++) {
+            job *j = &batch->jobs[i];
+            simulate(&w->cfg, j->op, j->address, j->size, j->opnum, NULL);
+        }
+        free(batch);
     }
-    return;
 }
 
+/* pushbatch hands the batch being filled over to its worker */
+void pushbatch(worker* w) {
+    pthread_mutex_lock(&w->lock);
+    while (w->count == JOB_QDEPTH) {
+        pthread_cond_wait(&w->nonfull, &w->lock);
+    }
+    w->queue[(w->head + w->count) % JOB_QDEPTH] = w->filling;
+    w->count++;
+    pthread_cond_signal(&w->nonempty);
+    pthread_mutex_unlock(&w->lock);
+    w->filling = (job_batch*) malloc(sizeof(job_batch));
+    w->filling->njobs = 0;
+}
 
+/* simulateparallel runs the whole trace through cfg on nthreads workers */
+void simulateparallel(config* cfg, trace_t* traces, int nthreads,
+                      int sized) {
+    long S = 1L << cfg->ourdim->s;
+    int b = cfg->ourdim->b;
+    const trace_rec_t *rec;
+    long opnum = 0;
+    int t;
 
+    if (nthreads > S) nthreads = (int) S;
+    worker *workers = (worker*) calloc(nthreads, sizeof(worker));
+    for (t = 0; t < nthreads; t++) {
+        worker *w = &workers[t];
+        w->cfg = *cfg;
+        w->ourdim = *cfg->ourdim;
+        w->cfg.ourdim = &w->ourdim;
+        w->filling = (job_batch*) malloc(sizeof(job_batch));
+        w->filling->njobs = 0;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->nonempty, NULL);
+        pthread_cond_init(&w->nonfull, NULL);
+        pthread_create(&w->tid, NULL, workermain, w);
+    }
+
+    while ((rec = trace_next(traces)) != NULL) {
+        long n = pieces(cfg, rec->addr, rec->size, sized);
+        for (long k = 0; k < n; k++) {
+            unsigned long address = piece(cfg, rec->addr, k);
+            long setindex = (address & cfg->setmask) >> b;
+            worker *w = &workers[setindex * nthreads / S];
+            job *j = &w->filling->jobs[w->filling->njobs++];
+            j->address = address;
+            j->opnum = opnum;
+            j->size = piecebytes(cfg, rec->addr, rec->size, n, k);
+            j->op = rec->op;
+            if (w->filling->njobs == JOB_BATCH) {
+                pushbatch(w);
+            }
+        }
+        opnum++;
+    }
+
+    /* flush partial batches, then merge the private counters */
+    for (t = 0; t < nthreads; t++) {
+        worker *w = &workers[t];
+        pushbatch(w);
+        free(w->filling);
+        pthread_mutex_lock(&w->lock);
+        w->done = 1;
+        pthread_cond_signal(&w->nonempty);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (t = 0; t < nthreads; t++) {
+        worker *w = &workers[t];
+        pthread_join(w->tid, NULL);
+        cfg->hit += w->cfg.hit;
+        cfg->miss += w->cfg.miss;
+        cfg->evict += w->cfg.evict;
+        cfg->bytesread += w->cfg.bytesread;
+        cfg->byteswritten += w->cfg.byteswritten;
+        cfg->ourdim->dcached += w->ourdim.dcached;
+        cfg->ourdim->devicted += w->ourdim.devicted;
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->nonempty);
+        pthread_cond_destroy(&w->nonfull);
+    }
+    free(workers);
+}
 
 int main(int argc, char* argv[]) {
-    dim *ourdim = (dim*) malloc(sizeof(dim));
-    char* trace_name;
+    int s = -1, E = -1, b = -1;
+    char** trace_names = NULL;
+    int ntraces = 0;
+    int protocol = -1;
+    int sized = 0;
+    int writethru = 0;
+    int noallocate = 0;
+    int wcsize = 0;
+    config **configs = NULL;
+    int nconfigs = 0;
+    int (*geoms)[3] = NULL;
+    int ngeoms = 0;
+    config **levels = NULL;
+    char **level_specs = NULL;
+    int nlevels = 0;
+    int inclusion = INCL_NINE;
+    policy *pol = &policies[0];
+    int nthreads = 1;
+    int classes = 0;
+    char* heat_name = NULL;
+    int regionbits = 12;
+    prefetcher* pf = NULL;
+    char* tlb_spec = NULL;
+    char* index_name = "mod";
+    config** ilevel = NULL;
+    char* ilevel_spec = NULL;
+    config* icache = NULL;
+    int pwcentries = 0;
+    long window = 0;
+    char* timeline_name = NULL;
     int i;
     /* get the argument and dimensions using getop */
-    while ((i = getopt(argc, argv, "s:E:b:t:")) != -1) {
+    while ((i = getopt(argc, argv, "s:E:b:t:G:j:r:L:I:CH:P:p:m:zw:nW:T:K:x:i:e:o:")) != -1) {
         switch(i) {
 
             case('s'):
-                ourdim->s = atoi(optarg);
+                s = atoi(optarg);
                 break;
 
             case('E'):
-	        ourdim->E = atoi(optarg);
+	        E = atoi(optarg);
 	        break;
 
             case('b'):
-	        ourdim->b = atoi(optarg);
+	        b = atoi(optarg);
                 break;
 
             case('t'):
-                trace_name = optarg;
+                /* more than one trace simulates one core per trace */
+                trace_names = realloc(trace_names,
+                                      sizeof(char*) * (ntraces + 1));
+                trace_names[ntraces++] = optarg;
+                break;
+
+            case('G'):
+                /* sweep mode: every geometry is simulated in one pass */
+                ngeoms = addgeometries(optarg, &geoms, ngeoms);
+                if (ngeoms < 0) exit(1);
+                break;
+
+            case('j'):
+                nthreads = atoi(optarg);
+                break;
+
+            case('r'):
+                pol = findpolicy(optarg);
+                if (pol == NULL) {
+                    fprintf(stderr, "Unknown replacement policy %s "
+                            "(lru, fifo, random, plru, srrip, brrip, opt)\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
+
+            case('L'):
+                /* hierarchy mode: one -L per level, L1 first */
+                level_specs = realloc(level_specs,
+                                      sizeof(char*) * (nlevels + 1));
+                level_specs[nlevels++] = optarg;
+                break;
+
+            case('I'):
+                if (strcmp(optarg, "nine") == 0) {
+                    inclusion = INCL_NINE;
+                } else if (strcmp(optarg, "inclusive") == 0) {
+                    inclusion = INCL_INCLUSIVE;
+                } else if (strcmp(optarg, "exclusive") == 0) {
+                    inclusion = INCL_EXCLUSIVE;
+                } else {
+                    fprintf(stderr, "Unknown inclusion policy %s "
+                            "(nine, inclusive, exclusive)\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case('C'):
+                /* classify misses as compulsory, capacity or conflict */
+                classes = 1;
+                break;
+
+            case('H'):
+                /* per-set and per-region heatmap, written as CSV */
+                heat_name = optarg;
+                break;
+
+            case('P'):
+                regionbits = atoi(optarg);
+                if (regionbits < 0 || regionbits > 63) {
+                    fprintf(stderr, "-P takes a region size of 0-63 bits\n");
+                    exit(1);
+                }
+                break;
+
+            case('p'):
+                pf = findprefetcher(optarg);
+                if (pf == NULL) {
+                    fprintf(stderr, "Unknown prefetcher %s "
+                            "(next, stride, stream)\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case('m'):
+                if (strcmp(optarg, "mesi") == 0) {
+                    protocol = COH_MESI;
+                } else if (strcmp(optarg, "moesi") == 0) {
+                    protocol = COH_MOESI;
+                } else {
+                    fprintf(stderr, "Unknown coherence protocol %s "
+                            "(mesi, moesi)\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case('z'):
+                /* honour access sizes: split accesses across blocks */
+                sized = 1;
+                break;
+
+            case('w'):
+                if (strcmp(optarg, "wb") == 0) {
+                    writethru = 0;
+                } else if (strcmp(optarg, "wt") == 0) {
+                    writethru = 1;
+                } else {
+                    fprintf(stderr, "Unknown write policy %s (wb, wt)\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
+
+            case('n'):
+                /* no-write-allocate */
+                noallocate = 1;
+                break;
+
+            case('W'):
+                /* write-combining buffer entries */
+                wcsize = atoi(optarg);
+                if (wcsize < 1) {
+                    fprintf(stderr, "-W needs a positive number of entries\n");
+                    exit(1);
+                }
+                break;
+
+            case('T'):
+                /* TLB: entries:assoc:pagebits */
+                tlb_spec = optarg;
+                break;
+
+            case('i'):
+                /* split L1: instruction fetches go to this cache */
+                ilevel_spec = optarg;
+                break;
+
+            case('x'):
+                /* set index function */
+                index_name = optarg;
+                break;
+
+            case('K'):
+                /* page-walk cache entries */
+                pwcentries = atoi(optarg);
+                if (pwcentries < 1) {
+                    fprintf(stderr, "-K needs a positive number of entries\n");
+                    exit(1);
+                }
+                break;
+
+            case('e'):
+                /* timeline: one CSV row per window of this many records */
+                window = atol(optarg);
+                if (window < 1) {
+                    fprintf(stderr, "-e needs a positive window length\n");
+                    exit(1);
+                }
+                break;
+
+            case('o'):
+                /* where the timeline goes, instead of stdout */
+                timeline_name = optarg;
                 break;
             default:
                 exit(1);
     	}
     }
 
-    /* start by making an empty cache */
-    cache *new_cache = make_cache(ourdim);
+    if (ntraces == 0) {
+        fprintf(stderr, "Missing required trace file argument -t\n");
+        exit(1);
+    }
 
-    /* declare variables for trace inputs */
-    char op;
-    long unsigned address;
-    int size;
-
-    long setindex;
-    long addrtag;
-    int hit = 0;
-    int miss = 0;
-    int evict = 0;
-    int opnum = 0;
-    ourdim->devicted = 0;
-    ourdim->dcached = 0;
-
-    int s = ourdim->s;
-    int b = ourdim->b;
-    long setmask = ((1 << (s + b)) - 1) - ((1 << b) - 1);
-    long tagmask = (~0) - ((1 << (s+b)) - 1);
-    cache_set *targetset;
-    int didHit;
-
-    /* now start reading in */
-    FILE *traces = fopen(trace_name, "r");
-    while (fscanf(traces, " %c %lx,%d", &op, &address, &size) == 3) {
-	    setindex = (address & setmask) >> b;
-        addrtag = (long) ((unsigned long) (address & tagmask)) >> (s+b);
-        targetset = &(new_cache->sets[setindex]);
-        didHit = isHit(targetset, addrtag, ourdim, opnum);
-
-        /* if the operation is hit */
-        if (didHit == 1) {
-            updatecache(targetset, addrtag, ourdim, opnum, didHit);
-            hit++;
-	    }
-
-        /* if missed */
-	    if (didHit == 0) {
-	        updatecache(targetset, addrtag, ourdim, opnum, didHit);
-	        miss++;
-        }
-
-        /* if missed, and needs to be evicted */
-	    if (didHit == -1) {
-    	    updatecache(targetset, addrtag, ourdim, opnum, didHit);
-            miss++;
-	        evict++;
-	    }
-        /* finally, handle dirty bytes */
-        markdirty(targetset, addrtag, ourdim, opnum, op, didHit);
-	    opnum++;
-    }
-    int d_cached = (ourdim->dcached) * (1 << b);
-    int d_evicted = (ourdim->devicted) * (1 << b);
-    printSummary(hit, miss, evict, d_cached, d_evicted);
-    freecache(new_cache, ourdim);
-    return 0;
-}
+    /* levels take -r as their default policy, so they are made once
+     * every option has been read; L1 decides the policy from then on */
+    for (i = 0; i < nlevels; i++) {
+        if (addlevel(level_specs[i], &levels, i, pol) < 0) exit(1);
+    }
+    free(level_specs);
+    if (nlevels > 0) pol = levels[0]->policy;
+    if (ilevel_spec != NULL) {
+        if (addlevel(ilevel_spec, &ilevel, 0, pol) < 0) exit(1);
+        icache = ilevel[0];
+    }
 
+    /* start by making empty caches, one per swept geometry or level */
+    int sweep = (ngeoms > 0);
+    int hierarchy = (nlevels > 0);
+    if (nthreads < 1 || ((sweep || hierarchy) && nthreads > 1)) {
+        fprintf(stderr, "-j needs a positive thread count and a single geometry\n");
+        exit(1);
+    }
+    if (classes && nthreads > 1) {
+        fprintf(stderr, "-C cannot be combined with -j\n");
+        exit(1);
+    }
+    if (heat_name != NULL && (sweep || nthreads > 1)) {
+        fprintf(stderr, "-H cannot be combined with -G or -j\n");
+        exit(1);
+    }
+    if (pf != NULL && (hierarchy || nthreads > 1
+                       || strcmp(pol->name, "opt") == 0)) {
+        fprintf(stderr, "-p cannot be combined with -L, -j or opt\n");
+        exit(1);
+    }
+    int coherent = (ntraces > 1 || protocol >= 0);
+    if (coherent && (sweep || hierarchy || nthreads > 1 || classes
+                     || heat_name != NULL || pf != NULL
+                     || strcmp(pol->name, "opt") == 0)) {
+        fprintf(stderr, "Several traces (or -m) only work with a single "
+                "geometry and no -j, -C, -H, -p or opt\n");
+        exit(1);
+    }
+    if (protocol < 0) protocol = COH_MESI;
+    if (sized && strcmp(pol->name, "opt") == 0) {
+        fprintf(stderr, "-z cannot be combined with opt\n");
+        exit(1);
+    }
+    if ((writethru || noallocate || wcsize > 0) && (hierarchy || coherent)) {
+        fprintf(stderr, "-w, -n and -W cannot be combined with -L or "
+                "several traces\n");
+        exit(1);
+    }
+    /* write-backs go out a block at a time; only stores that pass the
+     * cache by (-w wt, or -n store misses) can be combined */
+    if (wcsize > 0 && !writethru && !noallocate) {
+        fprintf(stderr, "-W needs -w wt or -n\n");
+        exit(1);
+    }
+    if (wcsize > 0 && nthreads > 1) {
+        fprintf(stderr, "-W cannot be combined with -j\n");
+        exit(1);
+    }
+    int indexed = strcmp(index_name, "mod") != 0;
+    if (indexed && nthreads > 1) {
+        fprintf(stderr, "-x cannot be combined with -j\n");
+        exit(1);
+    }
+    if (strcmp(index_name, "skew") == 0
+        && (hierarchy || coherent || classes || heat_name != NULL
+            || pf != NULL)) {
+        fprintf(stderr, "-x skew cannot be combined with -L, several "
+                "traces, -C, -H or -p\n");
+        exit(1);
+    }
+    if (icache != NULL && (sweep || coherent || nthreads > 1
+                           || inclusion != INCL_NINE
+                           || strcmp(pol->name, "opt") == 0
+                           || strcmp(icache->policy->name, "opt") == 0)) {
+        fprintf(stderr, "-i cannot be combined with -G, -j, several traces, "
+                "-I inclusive or exclusive, or opt\n");
+        exit(1);
+    }
+    if (tlb_spec != NULL && (coherent || nthreads > 1)) {
+        fprintf(stderr, "-T cannot be combined with -j or several traces\n");
+        exit(1);
+    }
+    if (window > 0 && (sweep || coherent || nthreads > 1)) {
+        fprintf(stderr, "-e cannot be combined with -G, -j or several "
+                "traces\n");
+        exit(1);
+    }
+    if (timeline_name != NULL && window == 0) {
+        fprintf(stderr, "-o needs a timeline (-e)\n");
+        exit(1);
+    }
+    if (pwcentries > 0 && tlb_spec == NULL) {
+        fprintf(stderr, "-K needs a TLB (-T)\n");
+        exit(1);
+    }
+    mmu *mm = NULL;
+    if (tlb_spec != NULL) {
+        mm = make_mmu(tlb_spec, pwcentries);
+        if (mm == NULL) exit(1);
+    }
+    if (sweep && hierarchy) {
+        fprintf(stderr, "-G and -L cannot be combined\n");
+        exit(1);
+    }
+    for (i = 1; inclusion == INCL_EXCLUSIVE && i < nlevels; i++) {
+        if (levels[i]->ourdim->b != levels[0]->ourdim->b) {
+            fprintf(stderr, "Exclusive levels must share one block size\n");
+            exit(1);
+        }
+    }
+    if (hierarchy) {
+        configs = levels;
+        nconfigs = nlevels;
+    } else if (!sweep) {
+        /* one cache, or one private cache per core */
+        ngeoms = ntraces;
+        geoms = malloc(sizeof(*geoms) * ngeoms);
+        for (i = 0; i < ngeoms; i++) {
+            geoms[i][0] = s;
+            geoms[i][1] = E;
+            geoms[i][2] = b;
+        }
+    }
+    if (!hierarchy) configs = (config**) malloc(sizeof(config*) * ngeoms);
+    for (i = 0; i < ngeoms; i++) {
+        if (checkdim(geoms[i][0], geoms[i][1], geoms[i][2], pol) < 0) exit(1);
+        configs[nconfigs++] = make_config(geoms[i][0], geoms[i][1],
+                                          geoms[i][2], pol);
+    }
+    free(geoms);
+    for (i = 0; i < nconfigs; i++) {
+        if (setindexing(configs[i], index_name) < 0) exit(1);
+        if (classes) make_classifier(configs[i]);
+        if (heat_name != NULL) make_heatmap(configs[i], regionbits);
+        if (pf != NULL) make_prefetcher(configs[i], pf);
+        configs[i]->writethrough = writethru;
+        configs[i]->noallocate = noallocate;
+        if (wcsize > 0) make_wcbuffer(configs[i], wcsize);
+    }
+    /* the L1I is indexed like the data caches */
+    if (icache != NULL && setindexing(icache, index_name) < 0) exit(1);
+
+    /* now start reading in; binary traces are walked in place */
+    const trace_rec_t *rec;
+    long opnum = 0;
+    trace_t **traces = (trace_t**) malloc(sizeof(trace_t*) * ntraces);
+    for (i = 0; i < ntraces; i++) {
+        traces[i] = trace_open(trace_names[i]);
+        if (traces[i] == NULL) {
+            fprintf(stderr, "Cannot open trace file %s\n", trace_names[i]);
+            exit(1);
+        }
+    }
+    free(trace_names);
 
+    /* OPT looks ahead, so it needs the whole trace before it starts */
+    if (strcmp(pol->name, "opt") == 0) {
+        long n = -1;
+        const trace_rec_t *recs = trace_load(traces[0], &n);
+        if (recs == NULL && n != 0) {
+            fprintf(stderr, "Out of memory loading the trace\n");
+            exit(1);
+        }
+        for (i = 0; i < (hierarchy ? 1 : nconfigs); i++) {
+            computenextuse(configs[i], recs, n);
+        }
+    }
 
+    timeline *tl = NULL;
+    if (window > 0) tl = make_timeline(timeline_name, window);
+
+    coherence *co = NULL;
+    if (nthreads > 1) {
+        simulateparallel(configs[0], traces[0], nthreads, sized);
+    } else if (coherent) {
+        co = make_coherence(protocol, ntraces);
+        simulatecoherent(configs, co, traces, sized);
+    } else if (hierarchy) {
+        while ((rec = trace_next(traces[0])) != NULL) {
+            if (mm != NULL) translate(mm, rec, sized, opnum);
+            if (icache != NULL && rec->op == 'I') {
+                fetch(icache, levels, nlevels, inclusion, rec, sized, opnum);
+                opnum++;
+                if (tl != NULL) timelinetick(tl, levels[0], opnum);
+                continue;
+            }
+            if (tl != NULL) timelinetouch(tl, levels[0], rec, sized);
+            long n = pieces(levels[0], rec->addr, rec->size, sized);
+            for (long k = 0; k < n; k++) {
+                hieraccess(levels, nlevels, 0, inclusion, rec->op,
+                           piece(levels[0], rec->addr, k),
+                           piecebytes(levels[0], rec->addr, rec->size, n, k),
+                           opnum);
+            }
+            opnum++;
+            if (tl != NULL) timelinetick(tl, levels[0], opnum);
+        }
+    } else {
+        while ((rec = trace_next(traces[0])) != NULL) {
+            if (mm != NULL) translate(mm, rec, sized, opnum);
+            if (icache != NULL && rec->op == 'I') {
+                fetch(icache, NULL, 0, inclusion, rec, sized, opnum);
+                opnum++;
+                if (tl != NULL) timelinetick(tl, configs[0], opnum);
+                continue;
+            }
+            if (tl != NULL) timelinetouch(tl, configs[0], rec, sized);
+            for (i = 0; i < nconfigs; i++) {
+                long n = pieces(configs[i], rec->addr, rec->size, sized);
+                for (long k = 0; k < n; k++) {
+                    simulate(configs[i], rec->op,
+                             piece(configs[i], rec->addr, k),
+                             piecebytes(configs[i], rec->addr, rec->size, n, k),
+                             opnum, NULL);
+                }
+            }
+            opnum++;
+            if (tl != NULL) timelinetick(tl, configs[0], opnum);
+        }
+    }
+    if (tl != NULL) {
+        timelineflush(tl, configs[0], opnum);
+        freetimeline(tl);
+    }
+    for (i = 0; i < ntraces; i++) {
+        trace_close(traces[i]);
+    }
+    free(traces);
+    for (i = 0; i < nconfigs; i++) {
+        if (configs[i]->wc != NULL) wcdrain(configs[i]);
+    }
+
+    if (heat_name != NULL) {
+        FILE *heat_fp = fopen(heat_name, "w");
+        if (heat_fp == NULL) {
+            perror(heat_name);
+            exit(1);
+        }
+        fprintf(heat_fp, "level,kind,index,hits,misses,evictions\n");
+        for (i = 0; i < nconfigs; i++) {
+            writeheatmap(heat_fp, configs[i], i + 1);
+        }
+        fclose(heat_fp);
+    }
+
+    if (coherent) {
+        for (i = 0; i < nconfigs; i++) {
+            printf("core%d ", i);
+            printrow(configs[i]);
+            if (sized) {
+                printf("core%d split_accesses:%ld\n", i, configs[i]->splits);
+            }
+        }
+        printcoherence(co);
+        freecoherence(co);
+    } else if (sweep) {
+        for (i = 0; i < nconfigs; i++) {
+            printrow(configs[i]);
+            if (sized) printf("split_accesses:%ld\n", configs[i]->splits);
+            if (classes) printclasses(configs[i], 0);
+            if (pf != NULL) printprefetch(configs[i]);
+        }
+    } else if (hierarchy) {
+        if (icache != NULL) {
+            printf("L1I ");
+            printrow(icache);
+            if (sized) printf("L1I split_accesses:%ld\n", icache->splits);
+        }
+        for (i = 0; i < nlevels; i++) {
+            /* with -i, the first level holds only data */
+            if (i == 0 && icache != NULL) printf("L1D ");
+            else printf("L%d ", i + 1);
+            printrow(levels[i]);
+            if (sized && i == 0) {
+                printf("L1 split_accesses:%ld\n", levels[0]->splits);
+            }
+            if (classes) {
+                printf("L%d ", i + 1);
+                printclasses(levels[i], 0);
+            }
+            if (inclusion == INCL_INCLUSIVE && i + 1 < nlevels) {
+                printf("L%d back_invalidations:%ld\n", i + 1,
+                       levels[i]->backinval);
+            }
+        }
+    } else {
+        config *cfg = configs[0];
+        b = cfg->ourdim->b;
+        long d_cached = (cfg->ourdim->dcached) * (1L << b);
+        long d_evicted = (cfg->ourdim->devicted) * (1L << b);
+        printSummary(cfg->hit, cfg->miss, cfg->evict, d_cached, d_evicted);
+        printf("bytes_read:%ld bytes_written:%ld\n", cfg->bytesread,
+               cfg->byteswritten + d_evicted);
+        if (sized) printf("split_accesses:%ld\n", cfg->splits);
+        if (classes) printclasses(cfg, 1);
+        if (pf != NULL) printprefetch(cfg);
+        if (icache != NULL) {
+            printf("L1I ");
+            printrow(icache);
+            if (sized) printf("L1I split_accesses:%ld\n", icache->splits);
+        }
+    }
+    if (icache != NULL) {
+        freeconfig(icache);
+        free(ilevel);
+    }
+    if (mm != NULL) {
+        printmmu(mm, sized);
+        freemmu(mm);
+    }
+
+    for (i = 0; i < nconfigs; i++) {
+        freeconfig(configs[i]);
+    }
+    free(configs);
+    return 0;
+}
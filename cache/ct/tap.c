@@ -0,0 +1,194 @@
+/*
+ * tap.c - Replacement for the tracing runtime's writer thread
+ *
+ * The runtime in ct.bc buffers the memory operations of the traced code
+ * and hands full buffers to a background writer thread, which prints
+ * them as text.  This writer is linked over the runtime's own (with
+ * llvm-link -override) and decodes the same buffers, but gives each
+ * operation to ct_tap when a tool has set it, so that a tool such as
+ * tracegen-ct can consume accesses directly.  With ct_tap unset it
+ * prints the runtime's text format to stdout.
+ *
+ * The buffer layout and the packing of an operation are the runtime's
+ * own, not an interface it documents, so ct_tap_check encodes known
+ * operations with the runtime's encoder (the functions instrumented code
+ * calls) and makes sure they decode back unchanged before anything is
+ * traced.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/* A buffer of operations, laid out as in the runtime */
+typedef struct ct_buffer {
+    uint32_t pos;            /* bytes of operations in data */
+    uint32_t length;         /* capacity of data */
+    uint32_t id;             /* thread that filled it */
+    uint32_t base;
+    struct ct_buffer *next;
+    uint64_t data[];
+} ct_buffer;
+
+#define CT_BUFFER_SIZE (1024 * 1024)
+
+/* Each operation is one word: the address in the low 50 bits, bit 58
+ * set for a store, and log2 of the size in bits 59-61 */
+#define CT_ADDR_MASK ((1ULL << 50) - 1)
+#define CT_WRITE_BIT 58
+#define CT_SIZE_SHIFT 59
+
+/* Runtime state (ct.bc) */
+extern ct_buffer *__ctQueuedBuffers;
+extern ct_buffer *__ctQueuedBufferTail;
+extern ct_buffer *__ctFreeBuffers;
+extern uint32_t __ctCurrentBuffers;
+extern uint32_t __ctThreadGlobalNumber;
+extern uint32_t __ctThreadExitNumber;
+extern pthread_mutex_t __ctQueueBufferLock;
+extern pthread_cond_t __ctQueueSignal;
+extern pthread_mutex_t __ctFreeBufferLock;
+extern pthread_cond_t __ctFreeSignal;
+
+/* Runtime encoder (ct.bc), as called by instrumented code: a basic
+ * block's operations are stored from pos, then pos is moved past them */
+extern char *__ctStoreBasicBlock(uint32_t bbid, uint32_t pos, ct_buffer *t);
+extern void __ctStoreMemOp(void *addr, char is_write, uint32_t pow_size,
+                           uint32_t c, char *r);
+extern uint32_t __ctStoreBasicBlockComplete(uint32_t numMemOps, uint32_t pos,
+                                            ct_buffer *t);
+
+/* Called for each operation, in program order, on the writer thread */
+void (*ct_tap)(char op, unsigned long addr, unsigned int size);
+
+static void decode(uint64_t op, char *kind, unsigned long *addr,
+                   unsigned int *size) {
+    *kind = (op >> CT_WRITE_BIT) & 1 ? 'S' : 'L';
+    *addr = op & CT_ADDR_MASK;
+    *size = 1U << ((op >> CT_SIZE_SHIFT) & 7);
+}
+
+/* Operations the self-check encodes: both kinds, every size a scalar
+ * access has, and addresses using the low and high address bits */
+static const struct {
+    char kind;
+    unsigned long addr;
+    unsigned int size;
+} probes[] = {
+    {'L', 0x1UL, 1},
+    {'S', 0x600000UL, 8},
+    {'L', 0x7ffc12345678UL, 4},
+    {'S', 0x3fffffffffff0UL, 2},
+    {'S', 0x2aUL, 16},
+    {'L', 0x555555554000UL, 8},
+};
+#define NPROBES (sizeof(probes) / sizeof(probes[0]))
+
+int ct_tap_check(void) {
+    ct_buffer *buf = calloc(1, sizeof(ct_buffer) + NPROBES * sizeof(uint64_t));
+    uint32_t i, pos, log;
+    char *r;
+    int bad = 0;
+
+    if (buf == NULL) return -1;
+    buf->length = NPROBES * sizeof(uint64_t);
+    r = __ctStoreBasicBlock(0, 0, buf);
+    for (i = 0; i < NPROBES; i++) {
+        for (log = 0; (1U << log) < probes[i].size; log++)
+            ;
+        __ctStoreMemOp((void *) probes[i].addr, probes[i].kind == 'S', log,
+                       i, r);
+    }
+    pos = __ctStoreBasicBlockComplete(NPROBES, 0, buf);
+
+    if (pos != buf->pos || pos != NPROBES * sizeof(uint64_t)) bad = 1;
+    for (i = 0; !bad && i < NPROBES; i++) {
+        char kind;
+        unsigned long addr;
+        unsigned int size;
+
+        decode(buf->data[i], &kind, &addr, &size);
+        if (kind != probes[i].kind || addr != probes[i].addr
+            || size != probes[i].size) {
+            fprintf(stderr, "Trace decoder expected %c %lx,%u but read "
+                    "%c %lx,%u\n", probes[i].kind, probes[i].addr,
+                    probes[i].size, kind, addr, size);
+            bad = 1;
+        }
+    }
+    if (bad)
+        fprintf(stderr, "The tracing runtime's buffer format has changed; "
+                "ct/tap.c must be updated to match it\n");
+    free(buf);
+    return bad ? -1 : 0;
+}
+
+static void consume(ct_buffer *buf) {
+    uint32_t i, n = buf->pos / sizeof(uint64_t);
+
+    for (i = 0; i < n; i++) {
+        char kind;
+        unsigned long addr;
+        unsigned int size;
+
+        decode(buf->data[i], &kind, &addr, &size);
+        if (ct_tap != NULL)
+            ct_tap(kind, addr, size);
+        else
+            printf(" %c %lx,%u\n", kind, addr, size);
+    }
+}
+
+/* Full-size buffers go back on the free list for the traced threads;
+ * smaller ones were allocated just for one flush */
+static void recycle(ct_buffer *buf) {
+    if (buf->length < CT_BUFFER_SIZE) {
+        free(buf);
+        return;
+    }
+    pthread_mutex_lock(&__ctFreeBufferLock);
+    buf->next = __ctFreeBuffers;
+    __ctFreeBuffers = buf;
+    __ctCurrentBuffers--;
+    pthread_cond_broadcast(&__ctFreeSignal);
+    pthread_mutex_unlock(&__ctFreeBufferLock);
+}
+
+void *__ctBackgroundThreadWriter(void *arg) {
+    struct timespec ts;
+    ct_buffer *buf;
+
+    pthread_mutex_lock(&__ctQueueBufferLock);
+    while (1) {
+        /* The last thread to exit does not signal, so poll for it */
+        while (__ctQueuedBuffers == NULL) {
+            if (__ctThreadExitNumber == __ctThreadGlobalNumber) {
+                pthread_mutex_unlock(&__ctQueueBufferLock);
+                fflush(stdout);
+                return NULL;
+            }
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10 * 1000 * 1000;
+            if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000 * 1000 * 1000;
+            }
+            pthread_cond_timedwait(&__ctQueueSignal, &__ctQueueBufferLock, &ts);
+        }
+
+        /* The head stays queued while it is read; producers only
+         * append at the tail */
+        buf = __ctQueuedBuffers;
+        pthread_mutex_unlock(&__ctQueueBufferLock);
+        consume(buf);
+
+        pthread_mutex_lock(&__ctQueueBufferLock);
+        __ctQueuedBuffers = buf->next;
+        if (__ctQueuedBuffers == NULL)
+            __ctQueuedBufferTail = NULL;
+        pthread_mutex_unlock(&__ctQueueBufferLock);
+        recycle(buf);
+        pthread_mutex_lock(&__ctQueueBufferLock);
+    }
+}
@@ -61,7 +61,11 @@ def main():
     # Check for handin.tar and untar
 
 
-    retcode = subprocess.call(['tar','-xvf','handin.tar','csim.c','trans.c','key.txt'])
+    # The handed-in files, as listed by HANDIN in the Makefile
+    handin = ['csim.c', 'libcsim.c', 'trace.c', 'addrmap.c',
+              'libcsim.h', 'cachemodel.h', 'trace.h', 'addrmap.h',
+              'trans.c', 'key.txt']
+    retcode = subprocess.call(['tar','-xvf','handin.tar'] + handin)
 
     if(retcode == 0):
         print "done"
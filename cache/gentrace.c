@@ -0,0 +1,262 @@
+/*
+ * gentrace.c - Generate large synthetic memory traces
+ *
+ * The traces in traces/ are a few hundred accesses at most; gentrace
+ * writes traces of any length with a chosen access pattern over a
+ * chosen footprint, in the text or the binary format (see trace.h):
+ *   seq     8-byte accesses walking the footprint, wrapping around
+ *   stride  accesses stride bytes apart, wrapping around
+ *   random  uniformly random 8-byte words
+ *   zipf    64-byte blocks drawn from a Zipf distribution (skew -a),
+ *           with the popular blocks scattered over the footprint
+ *   chase   a pointer chase: loads following a random cycle through
+ *           every 64-byte node of the footprint
+ *   trans   row-wise transposes of a square matrix of doubles: a load
+ *           from A[i][j] and a store to B[j][i], repeated
+ * Except for chase and trans, a fraction -w of the accesses are stores.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "trace.h"
+
+#define BASE 0x10000000UL /* address of the first byte of the footprint */
+#define NODE 64           /* zipf block and chase node size */
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+/* xorshift64*: fast and good enough for address streams */
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+/* uniform in [0, n) */
+static uint64_t below(uint64_t n) {
+    return rng() % n;
+}
+
+static double unit(void) {
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static FILE *out;
+static int binary;
+
+static void emit(char op, uint64_t addr, uint32_t size) {
+    int failed;
+    if (binary) failed = trace_write_rec(out, op, addr, size) < 0;
+    else failed = fprintf(out, " %c %lx,%u\n", op, (unsigned long) addr,
+                          size) < 0;
+    if (failed) {
+        perror("gentrace");
+        exit(1);
+    }
+}
+
+/* parsesize reads a byte count with an optional K, M or G suffix */
+static long parsesize(char* text) {
+    char *end;
+    long n = strtol(text, &end, 10);
+    switch (*end) {
+    case 'K': case 'k': n <<= 10; end++; break;
+    case 'M': case 'm': n <<= 20; end++; break;
+    case 'G': case 'g': n <<= 30; end++; break;
+    }
+    return *end == '\0' ? n : -1;
+}
+
+/* permutation returns a random ordering of [0, n) */
+static uint32_t* permutation(long n) {
+    uint32_t *p = malloc(n * sizeof(uint32_t));
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory for %ld nodes\n", n);
+        exit(1);
+    }
+    for (long i = 0; i < n; i++) p[i] = i;
+    for (long i = n - 1; i > 0; i--) {
+        long j = below(i + 1);
+        uint32_t t = p[i];
+        p[i] = p[j];
+        p[j] = t;
+    }
+    return p;
+}
+
+static void gen_zipf(long n, long footprint, double alpha, double stores) {
+    long blocks = footprint / NODE;
+    double *cdf = malloc(blocks * sizeof(double));
+    uint32_t *where = permutation(blocks);
+    double sum = 0;
+
+    if (cdf == NULL) {
+        fprintf(stderr, "Out of memory for %ld blocks\n", blocks);
+        exit(1);
+    }
+    for (long r = 0; r < blocks; r++) {
+        sum += 1.0 / pow(r + 1, alpha);
+        cdf[r] = sum;
+    }
+    for (long i = 0; i < n; i++) {
+        /* the first rank whose cumulative weight reaches u */
+        double u = unit() * sum;
+        long lo = 0, hi = blocks - 1;
+        while (lo < hi) {
+            long mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1;
+            else hi = mid;
+        }
+        emit(unit() < stores ? 'S' : 'L',
+             BASE + (uint64_t) where[lo] * NODE + below(NODE / 8) * 8, 8);
+    }
+    free(cdf);
+    free(where);
+}
+
+static void gen_chase(long n, long footprint) {
+    long nodes = footprint / NODE;
+    uint32_t *order = permutation(nodes);
+    uint32_t *next = malloc(nodes * sizeof(uint32_t));
+    long at = order[0];
+
+    if (next == NULL) {
+        fprintf(stderr, "Out of memory for %ld nodes\n", nodes);
+        exit(1);
+    }
+    /* one cycle through all nodes, in the order of the permutation */
+    for (long i = 0; i < nodes; i++) {
+        next[order[i]] = order[(i + 1) % nodes];
+    }
+    for (long i = 0; i < n; i++) {
+        emit('L', BASE + (uint64_t) at * NODE, 8);
+        at = next[at];
+    }
+    free(order);
+    free(next);
+}
+
+static void gen_trans(long n, long footprint) {
+    /* A and B share the footprint */
+    long side = (long) sqrt(footprint / 16.0);
+    uint64_t bbase = BASE + (uint64_t) side * side * 8;
+    long i = 0, j = 0;
+
+    if (side < 1) side = 1;
+    for (long k = 0; k < n; k += 2) {
+        emit('L', BASE + (uint64_t) (i * side + j) * 8, 8);
+        if (k + 1 < n) emit('S', bbase + (uint64_t) (j * side + i) * 8, 8);
+        if (++j == side) {
+            j = 0;
+            if (++i == side) i = 0;
+        }
+    }
+}
+
+static void usage(char* cmd) {
+    fprintf(stderr, "Usage: %s [-h] [-B] [-f footprint] [-s stride] [-a alpha] "
+            "[-w stores] [-r seed] [-o out] -p pattern -n count\n", cmd);
+    fprintf(stderr, "  -p <pattern> seq, stride, random, zipf, chase or trans\n");
+    fprintf(stderr, "  -n <count>   Number of accesses (K, M, G suffixes allowed)\n");
+    fprintf(stderr, "  -f <bytes>   Footprint (default 64M)\n");
+    fprintf(stderr, "  -s <bytes>   Stride of the stride pattern (default 64)\n");
+    fprintf(stderr, "  -a <alpha>   Skew of the zipf pattern (default 0.99)\n");
+    fprintf(stderr, "  -w <frac>    Fraction of stores (default 0.25)\n");
+    fprintf(stderr, "  -r <seed>    Random seed\n");
+    fprintf(stderr, "  -B           Write the binary format\n");
+    fprintf(stderr, "  -o <file>    Write there instead of stdout\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    char *pattern = NULL;
+    char *out_name = NULL;
+    long n = -1, footprint = 64L << 20, stride = 64;
+    double alpha = 0.99, stores = 0.25;
+    int c;
+
+    while ((c = getopt(argc, argv, "hp:n:f:s:a:w:r:Bo:")) != -1) {
+        switch (c) {
+        case 'p':
+            pattern = optarg;
+            break;
+        case 'n':
+            n = parsesize(optarg);
+            break;
+        case 'f':
+            footprint = parsesize(optarg);
+            break;
+        case 's':
+            stride = parsesize(optarg);
+            break;
+        case 'a':
+            alpha = atof(optarg);
+            break;
+        case 'w':
+            stores = atof(optarg);
+            break;
+        case 'r':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'B':
+            binary = 1;
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (pattern == NULL || n < 0 || footprint < NODE || stride < 1
+        || footprint / NODE > UINT32_MAX || alpha < 0) {
+        usage(argv[0]);
+    }
+
+    out = out_name ? fopen(out_name, "w") : stdout;
+    if (out == NULL) {
+        perror(out_name);
+        exit(1);
+    }
+    if (binary && trace_write_header(out) < 0) {
+        perror("gentrace");
+        exit(1);
+    }
+
+    if (strcmp(pattern, "seq") == 0 || strcmp(pattern, "stride") == 0) {
+        long step = strcmp(pattern, "seq") == 0 ? 8 : stride;
+        long offset = 0;
+        for (long i = 0; i < n; i++) {
+            emit(unit() < stores ? 'S' : 'L', BASE + offset, 8);
+            offset += step;
+            /* the next pass starts one word further along */
+            if (offset + 8 > footprint) offset = (offset % step + 8) % step;
+        }
+    } else if (strcmp(pattern, "random") == 0) {
+        for (long i = 0; i < n; i++) {
+            emit(unit() < stores ? 'S' : 'L',
+                 BASE + below(footprint / 8) * 8, 8);
+        }
+    } else if (strcmp(pattern, "zipf") == 0) {
+        gen_zipf(n, footprint, alpha, stores);
+    } else if (strcmp(pattern, "chase") == 0) {
+        gen_chase(n, footprint);
+    } else if (strcmp(pattern, "trans") == 0) {
+        gen_trans(n, footprint);
+    } else {
+        usage(argv[0]);
+    }
+
+    if (fflush(out) != 0) {
+        perror("gentrace");
+        exit(1);
+    }
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,998 @@
+/*
+ * libcsim.c - The cache model behind csim, usable on its own
+ *
+ * Everything that decides what a single access does to a cache lives
+ * here: the structure-of-arrays sets, replacement policies, write
+ * policies, prefetchers and the optional per-configuration bookkeeping
+ * (three-C classifier, heatmap).  csim drives it from trace files;
+ * other programs use the small API at the end of this file, declared in
+ * libcsim.h, to feed it accesses directly.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "cachemodel.h"
+#include "libcsim.h"
+
+static cache* make_cache(dim* ourdim) {
+    int s = ourdim->s;
+    int E = ourdim->E;
+
+    long S = 1L << s;
+    cache *new_cache = (cache*) malloc(sizeof(cache));
+    new_cache->sets = (cache_set*) malloc(sizeof(cache_set) * S);
+    new_cache->tags = (long*) calloc(S * E, sizeof(long));
+    new_cache->usecount = (long*) calloc(S * E, sizeof(long));
+    new_cache->isdirty = (char*) calloc(S * E, sizeof(char));
+    new_cache->meta = (unsigned char*) calloc(S * E, sizeof(char));
+    new_cache->isprefetched = (char*) calloc(S * E, sizeof(char));
+    new_cache->state = (unsigned char*) calloc(S * E, sizeof(char));
+
+    /* now for each set, point at its lines */
+    for (long i = 0; i < S; i ++) {
+        new_cache->sets[i].tags = &new_cache->tags[i * E];
+        new_cache->sets[i].usecount = &new_cache->usecount[i * E];
+        new_cache->sets[i].isdirty = &new_cache->isdirty[i * E];
+        new_cache->sets[i].meta = &new_cache->meta[i * E];
+        new_cache->sets[i].isprefetched = &new_cache->isprefetched[i * E];
+        new_cache->sets[i].state = &new_cache->state[i * E];
+    }
+
+    return new_cache;
+}
+
+/* free my cache */
+static void freecache(cache* our_cache, dim* ourdim) {
+    free(ourdim);
+    free(our_cache->tags);
+    free(our_cache->usecount);
+    free(our_cache->isdirty);
+    free(our_cache->meta);
+    free(our_cache->isprefetched);
+    free(our_cache->state);
+    free(our_cache->sets);
+    free(our_cache);
+    return;
+}
+
+/* lookup makes one fused pass over a set.  It returns the line holding
+ * addrtag, or -1 on a miss, in which case *victim is the line to fill:
+ * the first invalid line if there is one, otherwise the LRU line */
+int lookup (cache_set* targetset, long addrtag, int max_lines, int* victim) {
+    long *tags = targetset->tags;
+    long *usecount = targetset->usecount;
+    long lru = LONG_MAX;
+    int lru_line = 0;
+    int i = 0;
+
+#ifdef __AVX2__
+    /* four lines per step: compare tags and track the smallest stamp in
+     * each lane, then reduce the lanes once at the end */
+    if (max_lines >= 4) {
+        __m256i vtag = _mm256_set1_epi64x(addrtag);
+        __m256i zero = _mm256_setzero_si256();
+        __m256i minv = _mm256_set1_epi64x(LONG_MAX);
+        __m256i mini = zero;
+        __m256i idx = _mm256_setr_epi64x(0, 1, 2, 3);
+        __m256i four = _mm256_set1_epi64x(4);
+        long lanev[4], lanei[4];
+
+        for (; i + 4 <= max_lines; i += 4) {
+            __m256i t = _mm256_loadu_si256((__m256i*) &tags[i]);
+            __m256i u = _mm256_loadu_si256((__m256i*) &usecount[i]);
+            __m256i eq = _mm256_andnot_si256(_mm256_cmpeq_epi64(u, zero),
+                                             _mm256_cmpeq_epi64(t, vtag));
+            int m = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+            if (m) return i + __builtin_ctz(m);
+            __m256i lt = _mm256_cmpgt_epi64(minv, u);
+            minv = _mm256_blendv_epi8(minv, u, lt);
+            mini = _mm256_blendv_epi8(mini, idx, lt);
+            idx = _mm256_add_epi64(idx, four);
+        }
+        _mm256_storeu_si256((__m256i*) lanev, minv);
+        _mm256_storeu_si256((__m256i*) lanei, mini);
+        for (int k = 0; k < 4; k++) {
+            if (lanev[k] < lru || (lanev[k] == lru && lanei[k] < lru_line)) {
+                lru = lanev[k];
+                lru_line = (int) lanei[k];
+            }
+        }
+    }
+#endif
+
+    /* now check the (remaining) lines in a set */
+    for (; i < max_lines; i++) {
+        if (tags[i] == addrtag && usecount[i] != 0) {
+            return i;
+        }
+        if (usecount[i] < lru) {
+            lru = usecount[i];
+            lru_line = i;
+        }
+    }
+    *victim = lru_line;
+    return -1;
+}
+
+/*
+ * Replacement policies.  Every policy decision depends only on the set
+ * and the global opnum (random choices hash the opnum), so all of them
+ * give identical results in the set-partitioned -j mode.
+ */
+
+/* mix scrambles an opnum into a pseudo random number (splitmix64) */
+static unsigned long mix(long opnum) {
+    unsigned long z = (unsigned long) opnum + 0x9e3779b97f4a7c15UL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+/* LRU: stamp the line on every use, evict the oldest stamp */
+static void touchlru(config* cfg, cache_set* set, int line, long opnum,
+                     int fill) {
+    set->usecount[line] = opnum + 1;
+}
+
+static int victimlru(config* cfg, cache_set* set, int lru_line, long opnum) {
+    return lru_line;
+}
+
+/* FIFO: stamp the line only when it is filled */
+static void touchfifo(config* cfg, cache_set* set, int line, long opnum,
+                      int fill) {
+    if (fill) set->usecount[line] = opnum + 1;
+}
+
+/* random: any line of a full set */
+static int victimrandom(config* cfg, cache_set* set, int lru_line, long opnum) {
+    return (int) (mix(opnum) % cfg->ourdim->E);
+}
+
+/* tree-PLRU: meta[k - 1] is node k of a heap-ordered binary tree over the
+ * E (a power of two) lines; each bit points towards the half to evict */
+static void touchplru(config* cfg, cache_set* set, int line, long opnum,
+                      int fill) {
+    int E = cfg->ourdim->E;
+    set->usecount[line] = opnum + 1;
+    for (int node = line + E; node > 1; node /= 2) {
+        set->meta[node / 2 - 1] = !(node & 1); /* point at the sibling */
+    }
+}
+
+static int victimplru(config* cfg, cache_set* set, int lru_line, long opnum) {
+    int E = cfg->ourdim->E;
+    int node = 1;
+    while (node < E) {
+        node = 2 * node + set->meta[node - 1];
+    }
+    return node - E;
+}
+
+/* SRRIP/BRRIP: meta holds a 2-bit re-reference prediction value; hits
+ * predict near reuse, fills predict long (SRRIP) or mostly distant
+ * (BRRIP, long only once every BRRIP_LONG fills) reuse */
+#define RRPV_MAX 3
+#define BRRIP_LONG 32
+
+static void touchsrrip(config* cfg, cache_set* set, int line, long opnum,
+                       int fill) {
+    set->usecount[line] = opnum + 1;
+    set->meta[line] = fill ? RRPV_MAX - 1 : 0;
+}
+
+static void touchbrrip(config* cfg, cache_set* set, int line, long opnum,
+                       int fill) {
+    set->usecount[line] = opnum + 1;
+    if (!fill) {
+        set->meta[line] = 0;
+    } else {
+        set->meta[line] = (mix(opnum) % BRRIP_LONG) ? RRPV_MAX : RRPV_MAX - 1;
+    }
+}
+
+static int victimrrip(config* cfg, cache_set* set, int lru_line, long opnum) {
+    int E = cfg->ourdim->E;
+    int oldest = 0;
+    for (int i = 0; i < E; i++) {
+        if (set->meta[i] > set->meta[oldest]) oldest = i;
+    }
+    /* age every line until the oldest reaches RRPV_MAX */
+    int age = RRPV_MAX - set->meta[oldest];
+    for (int i = 0; age > 0 && i < E; i++) {
+        set->meta[i] += age;
+    }
+    return oldest;
+}
+
+/* Belady OPT: usecount holds the opnum of the line's next use (+1), so
+ * the victim is the line used furthest in the future */
+static void touchopt(config* cfg, cache_set* set, int line, long opnum,
+                     int fill) {
+    long next = cfg->nextuse[opnum];
+    set->usecount[line] = (next == LONG_MAX) ? LONG_MAX : next + 1;
+}
+
+static int victimopt(config* cfg, cache_set* set, int lru_line, long opnum) {
+    int E = cfg->ourdim->E;
+    int furthest = 0;
+    for (int i = 1; i < E; i++) {
+        if (set->usecount[i] > set->usecount[furthest]) furthest = i;
+    }
+    return furthest;
+}
+
+policy policies[] = {
+    {"lru", touchlru, victimlru},
+    {"fifo", touchfifo, victimlru},
+    {"random", touchlru, victimrandom},
+    {"plru", touchplru, victimplru},
+    {"srrip", touchsrrip, victimrrip},
+    {"brrip", touchbrrip, victimrrip},
+    {"opt", touchopt, victimopt},
+};
+
+policy* findpolicy(char* name) {
+    for (int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) return &policies[i];
+    }
+    return NULL;
+}
+
+/* computenextuse gives OPT its future knowledge in one backward pass
+ * over the loaded trace: nextuse[i] is the opnum of the next access to
+ * the block of access i, or LONG_MAX if there is none */
+void computenextuse(config* cfg, const trace_rec_t* recs, long n) {
+    int b = cfg->ourdim->b;
+    addrmap_t *upcoming = addrmap_new(1024);
+    cfg->nextuse = (long*) malloc(sizeof(long) * (n > 0 ? n : 1));
+    for (long i = n - 1; i >= 0; i--) {
+        long *next = addrmap_put(upcoming, recs[i].addr >> b, LONG_MAX);
+        cfg->nextuse[i] = *next;
+        *next = i;
+    }
+    addrmap_free(upcoming);
+}
+
+/* make_config builds an empty cache of the given dimension */
+config* make_config(int s, int E, int b, policy* pol) {
+    config *cfg = (config*) calloc(1, sizeof(config));
+    cfg->policy = pol;
+    cfg->ourdim = (dim*) calloc(1, sizeof(dim));
+    cfg->ourdim->s = s;
+    cfg->ourdim->E = E;
+    cfg->ourdim->b = b;
+    cfg->cache = make_cache(cfg->ourdim);
+    cfg->setmask = ((1L << (s + b)) - 1) - ((1L << b) - 1);
+    cfg->tagmask = (~0L) - ((1L << (s + b)) - 1);
+    return cfg;
+}
+
+void freeconfig(config* cfg) {
+    classifier *cl = cfg->classes;
+    if (cl != NULL) {
+        addrmap_free(cl->blocks);
+        free(cl->block);
+        free(cl->prev);
+        free(cl->next);
+        free(cl->setconflict);
+        free(cl);
+    }
+    if (cfg->wc != NULL) {
+        free(cfg->wc->blocks);
+        free(cfg->wc->masks);
+        free(cfg->wc);
+    }
+    if (cfg->pf != NULL) {
+        addrmap_free(cfg->pf->polluted);
+        free(cfg->pf);
+    }
+    if (cfg->heat != NULL) {
+        addrmap_free(cfg->heat->regions);
+        free(cfg->heat->sets);
+        free(cfg->heat->regionstats);
+        free(cfg->heat->regionids);
+        free(cfg->heat);
+    }
+    freecache(cfg->cache, cfg->ourdim);
+    free(cfg->nextuse);
+    free(cfg);
+}
+
+/* make_heatmap attaches a heatmap to a configuration */
+void make_heatmap(config* cfg, int regionbits) {
+    heatmap *heat = (heatmap*) calloc(1, sizeof(heatmap));
+    heat->sets = calloc(1L << cfg->ourdim->s, sizeof(*heat->sets));
+    heat->regions = addrmap_new(64);
+    heat->regionbits = regionbits;
+    cfg->heat = heat;
+}
+
+/* heatregion returns the counters of the region holding address */
+static long* heatregion(heatmap* heat, unsigned long address) {
+    unsigned long id = address >> heat->regionbits;
+    long *row = addrmap_get(heat->regions, id);
+    if (row != NULL) return heat->regionstats[*row];
+
+    /* rows are appended in order of first touch; grow by doubling */
+    if ((heat->nregions & (heat->nregions - 1)) == 0) {
+        long cap = heat->nregions ? 2 * heat->nregions : 1;
+        heat->regionstats = realloc(heat->regionstats,
+                                    cap * sizeof(*heat->regionstats));
+        heat->regionids = realloc(heat->regionids, cap * sizeof(unsigned long));
+    }
+    memset(heat->regionstats[heat->nregions], 0, sizeof(*heat->regionstats));
+    heat->regionids[heat->nregions] = id;
+    *addrmap_put(heat->regions, id, 0) = heat->nregions;
+    return heat->regionstats[heat->nregions++];
+}
+
+/* heatrecord counts one access (kind 0 for a hit, 1 for a miss) and
+ * the eviction it caused, which happened in the same set */
+static void heatrecord(heatmap* heat, unsigned long address, long setindex,
+                       int kind, evicted_line* ev) {
+    heat->sets[setindex][kind]++;
+    heatregion(heat, address)[kind]++;
+    if (ev->valid) {
+        heat->sets[setindex][2]++;
+        heatregion(heat, ev->address)[2]++;
+    }
+}
+
+/* make_classifier attaches a three-C classifier to a configuration */
+void make_classifier(config* cfg) {
+    classifier *cl = (classifier*) calloc(1, sizeof(classifier));
+    cl->blocks = addrmap_new(1024);
+    cl->capacity = (long) cfg->ourdim->E << cfg->ourdim->s;
+    cl->head = cl->tail = -1;
+    cl->setconflict = (long*) calloc(1L << cfg->ourdim->s, sizeof(long));
+    cfg->classes = cl;
+}
+
+/* unlinknode takes a shadow node out of the LRU list */
+static void unlinknode(classifier* cl, long n) {
+    if (cl->prev[n] >= 0) cl->next[cl->prev[n]] = cl->next[n];
+    else cl->head = cl->next[n];
+    if (cl->next[n] >= 0) cl->prev[cl->next[n]] = cl->prev[n];
+    else cl->tail = cl->prev[n];
+}
+
+/* classify labels an access to block, which missed in its set if !hit,
+ * and then moves the block to the front of the shadow cache */
+static void classify(classifier* cl, unsigned long block, int hit,
+                     long setindex) {
+    long *node = addrmap_get(cl->blocks, block);
+    long n;
+
+    if (!hit) {
+        if (node == NULL) {
+            cl->compulsory++;
+        } else if (*node < 0) {
+            cl->capacitymiss++;
+        } else {
+            cl->conflict++;
+            cl->setconflict[setindex]++;
+        }
+    }
+
+    if (node != NULL && *node >= 0) {
+        n = *node;
+        unlinknode(cl, n);
+    } else {
+        if (cl->used < cl->capacity) {
+            if (cl->used == cl->allocated) {
+                cl->allocated = cl->allocated ? 2 * cl->allocated : 1024;
+                if (cl->allocated > cl->capacity) cl->allocated = cl->capacity;
+                cl->block = realloc(cl->block,
+                                    cl->allocated * sizeof(unsigned long));
+                cl->prev = realloc(cl->prev, cl->allocated * sizeof(long));
+                cl->next = realloc(cl->next, cl->allocated * sizeof(long));
+            }
+            n = cl->used++;
+        } else {
+            n = cl->tail;
+            unlinknode(cl, n);
+            *addrmap_get(cl->blocks, cl->block[n]) = -1;
+        }
+        cl->block[n] = block;
+        *addrmap_put(cl->blocks, block, -1) = n;
+    }
+    cl->prev[n] = -1;
+    cl->next[n] = cl->head;
+    if (cl->head >= 0) cl->prev[cl->head] = n;
+    else cl->tail = n;
+    cl->head = n;
+}
+
+/* largestprime returns the largest prime no greater than n (1 for 1) */
+static long largestprime(long n) {
+    for (; n > 3; n--) {
+        long d = 2;
+        while (d * d <= n && n % d != 0) d++;
+        if (d * d > n) return n;
+    }
+    return n;
+}
+
+int setindexing(config* cfg, char* name) {
+    static char* names[] = {"mod", "xor", "prime", "skew"};
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) != 0) continue;
+        /* skew evicts the oldest of the lines a block may go to, so
+         * only policies that keep their state in the stamps apply */
+        if (i == IDX_SKEW && strcmp(cfg->policy->name, "lru") != 0
+            && strcmp(cfg->policy->name, "fifo") != 0) {
+            fprintf(stderr, "skew indexing needs the lru or fifo policy\n");
+            return -1;
+        }
+        cfg->index = i;
+        cfg->prime = largestprime(1L << cfg->ourdim->s);
+        return 0;
+    }
+    fprintf(stderr, "Unknown set index function %s (mod, xor, prime, skew)\n",
+            name);
+    return -1;
+}
+
+/* skewset is the set of a block in way w of a skewed cache: the top s
+ * bits of a multiplicative hash, with a different multiplier per way */
+static long skewset(config* cfg, long block, int w) {
+    int s = cfg->ourdim->s;
+    unsigned long h = ((unsigned long) block ^ ((unsigned long) block >> 29))
+                      * (0x9e3779b97f4a7c15UL + 2 * w);
+    return s == 0 ? 0 : (long) (h >> (64 - s));
+}
+
+/* locate finds the set and tag of an address */
+cache_set* locate(config* cfg, unsigned long address, long* setindex,
+                  long* addrtag) {
+    int s = cfg->ourdim->s;
+    int b = cfg->ourdim->b;
+    unsigned long block = address >> b;
+
+    switch (cfg->index) {
+    case IDX_XOR:
+        *setindex = 0;
+        for (; s > 0 && block != 0; block >>= s) {
+            *setindex ^= block & ((1UL << s) - 1);
+        }
+        *addrtag = (long) (address >> b);
+        break;
+    case IDX_PRIME:
+        *setindex = (long) (block % cfg->prime);
+        *addrtag = (long) block;
+        break;
+    default:
+        *setindex = (address & cfg->setmask) >> b;
+        *addrtag = (long) ((unsigned long) (address & cfg->tagmask)) >> (s+b);
+    }
+    return &(cfg->cache->sets[*setindex]);
+}
+
+/* fill puts addrtag into a set after a miss: an invalid line if there
+ * is one, otherwise the policy's victim, which is reported in *out */
+int fill(config* cfg, cache_set* targetset, long setindex, long addrtag,
+         int victim, long opnum, evicted_line* out) {
+    dim *ourdim = cfg->ourdim;
+    int line = victim;
+
+    if (out != NULL) out->valid = 0;
+    if (targetset->usecount[line] != 0) {
+        line = cfg->policy->victim(cfg, targetset, victim, opnum);
+        cfg->evict++;
+        ourdim->devicted += targetset->isdirty[line];
+        ourdim->dcached -= targetset->isdirty[line];
+        if (targetset->isprefetched[line]) cfg->pf->useless++;
+        if (out != NULL) {
+            out->valid = 1;
+            out->prefetched = targetset->isprefetched[line];
+            out->dirty = targetset->isdirty[line];
+            if (cfg->index == IDX_MOD) {
+                out->address = ((unsigned long) targetset->tags[line]
+                                << (ourdim->s + ourdim->b))
+                               | ((unsigned long) setindex << ourdim->b);
+            } else {
+                out->address = (unsigned long) targetset->tags[line]
+                               << ourdim->b;
+            }
+        }
+    }
+    targetset->tags[line] = addrtag;
+    targetset->isdirty[line] = 0;
+    targetset->isprefetched[line] = 0;
+    cfg->policy->touch(cfg, targetset, line, opnum, 1);
+    return line;
+}
+
+/* markdirty sets the dirty bit of a line, counting newly dirty bytes */
+void markdirty(config* cfg, cache_set* targetset, int line) {
+    cfg->ourdim->dcached += !targetset->isdirty[line];
+    targetset->isdirty[line] = 1;
+}
+
+/* make_wcbuffer attaches a write-combining buffer of n entries */
+void make_wcbuffer(config* cfg, int n) {
+    wcbuffer *wc = (wcbuffer*) calloc(1, sizeof(wcbuffer));
+    wc->blocks = (unsigned long*) calloc(n, sizeof(unsigned long));
+    wc->masks = (unsigned long*) calloc(n, sizeof(unsigned long));
+    wc->size = n;
+    cfg->wc = wc;
+}
+
+/* chunkbits returns log2 of the bytes covered by one bit of a mask */
+static int chunkbits(config* cfg) {
+    return cfg->ourdim->b > 6 ? cfg->ourdim->b - 6 : 0;
+}
+
+/* wcflush writes out the chunks collected by one buffer entry */
+static void wcflush(config* cfg, int entry) {
+    cfg->byteswritten += (long) __builtin_popcountl(cfg->wc->masks[entry])
+                         << chunkbits(cfg);
+    cfg->wc->masks[entry] = 0;
+}
+
+/* wcdrain empties the buffer at the end of a run */
+void wcdrain(config* cfg) {
+    for (int i = 0; i < cfg->wc->used; i++) {
+        wcflush(cfg, i);
+    }
+    cfg->wc->used = 0;
+}
+
+/* writethrough sends a store of size bytes to the next level, through
+ * the write-combining buffer if there is one */
+static void writethrough(config* cfg, unsigned long address,
+                         unsigned int size) {
+    wcbuffer *wc = cfg->wc;
+    int b = cfg->ourdim->b;
+    int chunk = chunkbits(cfg);
+    unsigned long block = address >> b;
+    unsigned long offset = address & ((1UL << b) - 1);
+    unsigned long mask = 0;
+    int i;
+
+    if (size == 0) size = 1;
+    if (wc == NULL) {
+        cfg->byteswritten += size;
+        return;
+    }
+    /* bytes beyond the block are clipped; -z splits such stores */
+    for (unsigned long a = offset >> chunk;
+         a < (1UL << (b - chunk)) && a <= (offset + size - 1) >> chunk; a++) {
+        mask |= 1UL << a;
+    }
+    for (i = 0; i < wc->used; i++) {
+        if (wc->blocks[i] == block) {
+            wc->masks[i] |= mask;
+            wc->merges++;
+            return;
+        }
+    }
+    if (wc->used < wc->size) {
+        i = wc->used++;
+    } else {
+        i = wc->next;
+        wc->next = (wc->next + 1) % wc->size;
+        wcflush(cfg, i);
+    }
+    wc->blocks[i] = block;
+    wc->masks[i] = mask;
+}
+
+/* simulateskew is simulate for a skewed cache: way w of the block's
+ * set in that way is one candidate line per way.  A miss fills an
+ * invalid candidate if there is one, else the one with the oldest
+ * stamp.  The classifier, heatmap and prefetchers are not supported */
+static int simulateskew(config* cfg, char op, unsigned long address,
+                        unsigned int size, long opnum, evicted_line* out) {
+    dim *ourdim = cfg->ourdim;
+    long block = (long) (address >> ourdim->b);
+    cache_set *set = NULL;
+    int line = 0;
+    int hit = 0;
+
+    for (int w = 0; w < ourdim->E; w++) {
+        cache_set *cand = &cfg->cache->sets[skewset(cfg, block, w)];
+        if (cand->usecount[w] != 0 && cand->tags[w] == block) {
+            set = cand;
+            line = w;
+            hit = 1;
+            break;
+        }
+        if (set == NULL || cand->usecount[w] < set->usecount[line]) {
+            set = cand;
+            line = w;
+        }
+    }
+    if (out != NULL) out->valid = 0;
+
+    if (hit) {
+        cfg->hit++;
+        cfg->policy->touch(cfg, set, line, opnum, 0);
+    } else if (op == 'S' && cfg->noallocate) {
+        /* the store goes around the cache */
+        cfg->miss++;
+        line = -1;
+    } else {
+        cfg->miss++;
+        if (set->usecount[line] != 0) {
+            cfg->evict++;
+            ourdim->devicted += set->isdirty[line];
+            ourdim->dcached -= set->isdirty[line];
+            if (out != NULL) {
+                out->valid = 1;
+                out->prefetched = 0;
+                out->dirty = set->isdirty[line];
+                out->address = (unsigned long) set->tags[line] << ourdim->b;
+            }
+        }
+        set->tags[line] = block;
+        set->isdirty[line] = 0;
+        cfg->policy->touch(cfg, set, line, opnum, 1);
+        cfg->bytesread += 1L << ourdim->b;
+    }
+
+    /* a Save op dirties the line, unless it is written through */
+    if (op == 'S') {
+        if (cfg->writethrough || line < 0) {
+            writethrough(cfg, address, size);
+        } else {
+            markdirty(cfg, set, line);
+        }
+    }
+    return hit;
+}
+
+/* simulate runs one trace operation through a configuration: a single
+ * lookup pass, then the line update and dirty byte bookkeeping.  Returns
+ * 1 on a hit; a line evicted by a miss is reported in *out if given */
+int simulate(config* cfg, char op, unsigned long address, unsigned int size,
+             long opnum, evicted_line* out) {
+    if (cfg->index == IDX_SKEW) {
+        return simulateskew(cfg, op, address, size, opnum, out);
+    }
+    long setindex, addrtag;
+    cache_set *targetset = locate(cfg, address, &setindex, &addrtag);
+    int victim = 0;
+    int line = lookup(targetset, addrtag, cfg->ourdim->E, &victim);
+    int hit = (line >= 0);
+    int trigger = !hit;
+    evicted_line ev;
+
+    /* the heatmap needs to know what was evicted */
+    if (cfg->heat != NULL && out == NULL) out = &ev;
+
+    if (cfg->classes != NULL) {
+        classify(cfg->classes, address >> cfg->ourdim->b, hit, setindex);
+    }
+    if (hit) {
+        cfg->hit++;
+        cfg->policy->touch(cfg, targetset, line, opnum, 0);
+        if (out != NULL) out->valid = 0;
+        if (targetset->isprefetched[line]) {
+            cfg->pf->useful++;
+            targetset->isprefetched[line] = 0;
+            trigger = 1;
+        }
+    } else {
+        cfg->miss++;
+        if (cfg->pf != NULL
+            && addrmap_remove(cfg->pf->polluted, address >> cfg->ourdim->b)) {
+            cfg->pf->pollution++;
+        }
+        if (op == 'S' && cfg->noallocate) {
+            /* the store goes around the cache */
+            if (out != NULL) out->valid = 0;
+            line = -1;
+        } else {
+            line = fill(cfg, targetset, setindex, addrtag, victim, opnum, out);
+            cfg->bytesread += 1L << cfg->ourdim->b;
+        }
+    }
+    if (cfg->heat != NULL) {
+        heatrecord(cfg->heat, address, setindex, !hit, out);
+    }
+    if (cfg->pf != NULL) {
+        cfg->pf->pf->train(cfg, address, trigger, opnum);
+    }
+
+    /* a Save op dirties the line, unless it is written through */
+    if (op == 'S') {
+        if (cfg->writethrough || line < 0) {
+            writethrough(cfg, address, size);
+        } else {
+            markdirty(cfg, targetset, line);
+        }
+    }
+    return hit;
+}
+
+/*
+ * Access sizes (-z).  By default an access touches only the block of
+ * its first byte, as in the reference simulator.  With -z an access of
+ * size bytes touches every block it overlaps; each of them counts as a
+ * hit or miss of its own, and the access is counted once as a split.
+ */
+
+/* pieces returns the number of blocks an access touches, counting a
+ * split on cfg if there is more than one */
+long pieces(config* cfg, unsigned long address, unsigned int size,
+            int sized) {
+    int b = cfg->ourdim->b;
+    long n;
+    if (!sized || size <= 1) return 1;
+    n = (long) (((address + size - 1) >> b) - (address >> b)) + 1;
+    if (n > 1) cfg->splits++;
+    return n;
+}
+
+/* piece returns the address of the k-th block an access touches */
+unsigned long piece(config* cfg, unsigned long address, long k) {
+    int b = cfg->ourdim->b;
+    return k == 0 ? address : ((address >> b) + k) << b;
+}
+
+/* piecebytes returns how many bytes of an access split into n pieces
+ * fall in the k-th; an unsplit access keeps its whole size */
+unsigned int piecebytes(config* cfg, unsigned long address, unsigned int size,
+                        long n, long k) {
+    unsigned long start = piece(cfg, address, k);
+    unsigned long end = ((start >> cfg->ourdim->b) + 1) << cfg->ourdim->b;
+    if (n == 1) return size;
+    if (end > address + size) end = address + size;
+    return (unsigned int) (end - start);
+}
+
+/* invalidate removes the block holding address, if present.  Returns
+ * 1 if it was present, with its dirty bit in *dirty */
+int invalidate(config* cfg, unsigned long address, int* dirty) {
+    long setindex, addrtag;
+    cache_set *targetset = locate(cfg, address, &setindex, &addrtag);
+    int victim = 0;
+    int line = lookup(targetset, addrtag, cfg->ourdim->E, &victim);
+
+    if (line < 0) return 0;
+    *dirty = targetset->isdirty[line];
+    cfg->ourdim->dcached -= *dirty;
+    targetset->usecount[line] = 0;
+    targetset->isdirty[line] = 0;
+    targetset->isprefetched[line] = 0;
+    return 1;
+}
+
+/* probe looks for the block holding address on behalf of an exclusive
+ * level above.  It counts a hit or a miss, seen by the classifier and
+ * the heatmap like any access, and on a hit takes the block out for
+ * the level above.  Returns 1 on a hit, with its dirty bit in *dirty */
+int probe(config* cfg, unsigned long address, int* dirty) {
+    long setindex, addrtag;
+    int hit;
+    evicted_line none;
+
+    locate(cfg, address, &setindex, &addrtag);
+    hit = invalidate(cfg, address, dirty);
+    if (hit) cfg->hit++;
+    else cfg->miss++;
+    if (cfg->classes != NULL) {
+        classify(cfg->classes, address >> cfg->ourdim->b, hit, setindex);
+    }
+    if (cfg->heat != NULL) {
+        none.valid = 0;
+        heatrecord(cfg->heat, address, setindex, !hit, &none);
+    }
+    return hit;
+}
+
+/* insert places a block in the cache without counting an access, as
+ * when an upper exclusive level hands down its victim */
+void insert(config* cfg, unsigned long address, int dirty, long opnum,
+            evicted_line* out) {
+    long setindex, addrtag;
+    cache_set *targetset = locate(cfg, address, &setindex, &addrtag);
+    int victim = 0;
+    int line = lookup(targetset, addrtag, cfg->ourdim->E, &victim);
+
+    if (line >= 0) {
+        cfg->policy->touch(cfg, targetset, line, opnum, 0);
+        if (out != NULL) out->valid = 0;
+    } else {
+        line = fill(cfg, targetset, setindex, addrtag, victim, opnum, out);
+    }
+    if (dirty) markdirty(cfg, targetset, line);
+}
+
+/*
+ * Prefetchers (-p).  A prefetch fills a block into the cache like a
+ * demand miss would, but is not counted as an access; the line is
+ * tagged until its first demand hit.  Blocks evicted to make room for
+ * prefetches are remembered so later demand misses on them count as
+ * pollution.
+ */
+
+/* prefetch brings the block holding address into the cache */
+static void prefetch(config* cfg, unsigned long address, long opnum) {
+    prefetch_state *ps = cfg->pf;
+    long setindex, addrtag;
+    cache_set *targetset = locate(cfg, address, &setindex, &addrtag);
+    int victim = 0;
+    evicted_line ev;
+
+    if (lookup(targetset, addrtag, cfg->ourdim->E, &victim) >= 0) return;
+    ps->issued++;
+    addrmap_remove(ps->polluted, address >> cfg->ourdim->b);
+    int line = fill(cfg, targetset, setindex, addrtag, victim, opnum, &ev);
+    targetset->isprefetched[line] = 1;
+    cfg->bytesread += 1L << cfg->ourdim->b;
+    if (ev.valid) {
+        /* fill counted it as a demand eviction; it is the prefetcher's */
+        cfg->evict--;
+        ps->evict++;
+        if (!ev.prefetched) {
+            addrmap_put(ps->polluted, ev.address >> cfg->ourdim->b, 0);
+        }
+    }
+}
+
+/* next-line: fetch the following block on every trigger */
+static void trainnext(config* cfg, unsigned long address, int trigger,
+                      long opnum) {
+    int b = cfg->ourdim->b;
+    if (trigger) prefetch(cfg, (address >> b << b) + (1UL << b), opnum);
+}
+
+/* stride: without PCs, a table indexed by 4 KB page follows the stride
+ * between consecutive accesses to each page.  Once a stride repeats,
+ * fetch the first block it reaches beyond the current one */
+static void trainstride(config* cfg, unsigned long address, int trigger,
+                        long opnum) {
+    prefetch_state *ps = cfg->pf;
+    unsigned long page = address >> 12;
+    int b = cfg->ourdim->b;
+    long stride;
+
+    stride_entry *e = &ps->stride[page % STRIDE_ENTRIES];
+    if (e->page != page || e->last == 0) {
+        e->page = page;
+        e->last = address;
+        e->stride = 0;
+        e->confidence = 0;
+        return;
+    }
+    stride = (long) (address - e->last);
+    if (stride == 0) return;
+    if (stride == e->stride) {
+        if (e->confidence < 3) e->confidence++;
+    } else {
+        e->stride = stride;
+        e->confidence = 0;
+    }
+    e->last = address;
+    if (e->confidence >= 1) {
+        long step = labs(stride) >= (1L << b) ? 1 : (1L << b) / labs(stride);
+        prefetch(cfg, address + step * stride, opnum);
+    }
+}
+
+/* stream: up to STREAM_COUNT streams of sequential blocks, each kept
+ * STREAM_DEPTH blocks ahead of its latest use.  A trigger near a
+ * stream's head advances it; a miss elsewhere replaces the least
+ * recently used stream, ascending unless it follows the previous miss
+ * downwards */
+static void trainstream(config* cfg, unsigned long address, int trigger,
+                        long opnum) {
+    prefetch_state *ps = cfg->pf;
+    int b = cfg->ourdim->b;
+    long block = (long) (address >> b);
+    int i, lru = 0;
+
+    if (!trigger) return;
+    for (i = 0; i < STREAM_COUNT; i++) {
+        int dir = ps->streams[i].dir;
+        long ahead = (ps->streams[i].head - block) * dir;
+        if (dir != 0 && ahead >= 0 && ahead <= STREAM_DEPTH) break;
+        if (ps->streams[i].lastuse < ps->streams[lru].lastuse) lru = i;
+    }
+    if (i == STREAM_COUNT) {
+        i = lru;
+        ps->streams[i].dir = (block == ps->lastmiss - 1) ? -1 : 1;
+        ps->streams[i].head = block;
+        ps->lastmiss = block;
+    }
+    ps->streams[i].lastuse = opnum + 1;
+    while ((ps->streams[i].head - block) * ps->streams[i].dir < STREAM_DEPTH) {
+        ps->streams[i].head += ps->streams[i].dir;
+        prefetch(cfg, (unsigned long) ps->streams[i].head << b, opnum);
+    }
+}
+
+prefetcher prefetchers[] = {
+    {"next", trainnext},
+    {"stride", trainstride},
+    {"stream", trainstream},
+};
+
+prefetcher* findprefetcher(char* name) {
+    for (int i = 0; i < sizeof(prefetchers) / sizeof(prefetchers[0]); i++) {
+        if (strcmp(prefetchers[i].name, name) == 0) return &prefetchers[i];
+    }
+    return NULL;
+}
+
+/* make_prefetcher attaches a prefetcher to a configuration */
+void make_prefetcher(config* cfg, prefetcher* pf) {
+    cfg->pf = (prefetch_state*) calloc(1, sizeof(prefetch_state));
+    cfg->pf->pf = pf;
+    cfg->pf->polluted = addrmap_new(1024);
+    cfg->pf->lastmiss = -2;
+}
+
+/* checkdim rejects dimensions that cannot be simulated */
+int checkdim(int s, int E, int b, policy* pol) {
+    if (s < 0 || b < 0 || E < 1 || s + b > 62 || s > 30) {
+        fprintf(stderr, "Invalid cache dimension s=%d E=%d b=%d\n", s, E, b);
+        return -1;
+    }
+    if (strcmp(pol->name, "plru") == 0 && (E & (E - 1)) != 0) {
+        fprintf(stderr, "plru needs a power of two E, not %d\n", E);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Public API (libcsim.h).  A csim_t is one configuration with its own
+ * operation counter; accesses touch the block holding their first byte,
+ * like csim without -z, and size only matters to write-through traffic.
+ */
+struct csim {
+    config* cfg;
+    long opnum;
+};
+
+csim_t* csim_new(int s, int E, int b, const char* policyname) {
+    policy *pol = findpolicy(policyname ? (char*) policyname : "lru");
+    csim_t *sim;
+
+    if (pol == NULL) {
+        fprintf(stderr, "Unknown replacement policy %s "
+                "(lru, fifo, random, plru, srrip, brrip)\n", policyname);
+        return NULL;
+    }
+    /* OPT needs the whole trace in advance, which a stream cannot give */
+    if (strcmp(pol->name, "opt") == 0) {
+        fprintf(stderr, "opt cannot simulate accesses one at a time\n");
+        return NULL;
+    }
+    if (checkdim(s, E, b, pol) < 0) return NULL;
+    sim = (csim_t*) malloc(sizeof(csim_t));
+    sim->cfg = make_config(s, E, b, pol);
+    sim->opnum = 0;
+    return sim;
+}
+
+int csim_access(csim_t* sim, char op, unsigned long address,
+                unsigned int size) {
+    return simulate(sim->cfg, op, address, size, sim->opnum++, NULL);
+}
+
+void csim_stats(csim_t* sim, csim_stats_t* stats) {
+    config *cfg = sim->cfg;
+    int b = cfg->ourdim->b;
+    stats->hits = cfg->hit;
+    stats->misses = cfg->miss;
+    stats->evictions = cfg->evict;
+    stats->dirty_bytes_in_cache = cfg->ourdim->dcached << b;
+    stats->dirty_bytes_evicted = cfg->ourdim->devicted << b;
+    stats->bytes_read = cfg->bytesread;
+    stats->bytes_written = cfg->byteswritten + (cfg->ourdim->devicted << b);
+}
+
+void csim_free(csim_t* sim) {
+    freeconfig(sim->cfg);
+    free(sim);
+}
@@ -0,0 +1,41 @@
+/*
+ * libcsim.h - Feed memory accesses to a simulated cache in-process
+ *
+ * The same model csim uses, without trace files:
+ *
+ *      csim_t *sim = csim_new(5, 1, 5, NULL);
+ *      csim_access(sim, 'L', address, 8);
+ *      ...
+ *      csim_stats(sim, &stats);
+ *      csim_free(sim);
+ */
+#ifndef CACHELAB_LIBCSIM_H
+#define CACHELAB_LIBCSIM_H
+
+/* One simulated cache */
+typedef struct csim csim_t;
+
+/* Counters of a cache, in the units csim prints them in */
+typedef struct {
+    long hits;
+    long misses;
+    long evictions;
+    long dirty_bytes_in_cache;
+    long dirty_bytes_evicted;
+    long bytes_read;     /* fetched from the next level */
+    long bytes_written;  /* written to the next level */
+} csim_stats_t;
+
+/* Make an empty cache of 2^s sets of E lines of 2^b bytes, replaced by
+ * the named policy (NULL for LRU; opt is not available).  Returns NULL,
+ * after a message on stderr saying why, if it cannot. */
+csim_t *csim_new(int s, int E, int b, const char *policy);
+
+/* Run one access ('L', 'S', 'M' or 'I') of size bytes; returns 1 on a hit */
+int csim_access(csim_t *sim, char op, unsigned long address,
+                unsigned int size);
+
+void csim_stats(csim_t *sim, csim_stats_t *stats);
+void csim_free(csim_t *sim);
+
+#endif /* CACHELAB_LIBCSIM_H */
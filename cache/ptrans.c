@@ -0,0 +1,156 @@
+/*
+ * ptrans.c - Multithreaded cache-oblivious transpose
+ *
+ * The matrix is split the cache-oblivious way, always halving the
+ * longer side, until there are enough tiles to keep every thread busy.
+ * The tiles are listed in the order the recursion visits them, and the
+ * threads take them from that list in turn, so neighbouring threads
+ * work on neighbouring parts of A and B.  Each thread then keeps
+ * halving its tile down to small leaves, which fit in any L1D whatever
+ * its size.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ptrans.h"
+
+/* Leaves are at most LEAF x LEAF elements (2KB of A, 2KB of B) */
+#define LEAF 16
+/* Tiles handed out per thread, enough to even out uneven threads */
+#define TILES_PER_THREAD 16
+/* Smallest tile worth a thread: 32KB of A and of B */
+#define MIN_TILE (64 * 64)
+
+typedef struct {
+    size_t i0, i1;  /* rows of A */
+    size_t j0, j1;  /* columns of A */
+} tile;
+
+/* One call of ptrans, shared by its threads */
+typedef struct {
+    size_t M;
+    size_t N;
+    const double *A;
+    double *B;
+    tile *tiles;
+    int ntiles;
+    int maxtiles;
+    size_t tile_area;   /* split until tiles are no larger */
+    int next;           /* next tile to hand out */
+    pthread_mutex_t lock;
+} job;
+
+static void transpose(job *jb, size_t i0, size_t i1, size_t j0, size_t j1)
+{
+    size_t i, j, mid;
+
+    if (i1 - i0 <= LEAF && j1 - j0 <= LEAF) {
+        for (i = i0; i < i1; i++)
+            for (j = j0; j < j1; j++)
+                jb->B[j * jb->N + i] = jb->A[i * jb->M + j];
+    } else if (i1 - i0 >= j1 - j0) {
+        mid = i0 + (i1 - i0) / 2;
+        transpose(jb, i0, mid, j0, j1);
+        transpose(jb, mid, i1, j0, j1);
+    } else {
+        mid = j0 + (j1 - j0) / 2;
+        transpose(jb, i0, i1, j0, mid);
+        transpose(jb, i0, i1, mid, j1);
+    }
+}
+
+/* split lists the tiles of rows [i0, i1) by columns [j0, j1); returns
+ * -1 if it runs out of memory */
+static int split(job *jb, size_t i0, size_t i1, size_t j0, size_t j1)
+{
+    size_t mid;
+
+    if ((i1 - i0) * (j1 - j0) <= jb->tile_area
+        || (i1 - i0 <= LEAF && j1 - j0 <= LEAF)) {
+        tile *t;
+        if (jb->ntiles == jb->maxtiles) {
+            jb->maxtiles = jb->maxtiles ? 2 * jb->maxtiles : 64;
+            t = realloc(jb->tiles, jb->maxtiles * sizeof(tile));
+            if (t == NULL)
+                return -1;
+            jb->tiles = t;
+        }
+        t = &jb->tiles[jb->ntiles++];
+        t->i0 = i0;
+        t->i1 = i1;
+        t->j0 = j0;
+        t->j1 = j1;
+        return 0;
+    }
+    if (i1 - i0 >= j1 - j0) {
+        mid = i0 + (i1 - i0) / 2;
+        return split(jb, i0, mid, j0, j1) < 0 ? -1 : split(jb, mid, i1, j0, j1);
+    }
+    mid = j0 + (j1 - j0) / 2;
+    return split(jb, i0, i1, j0, mid) < 0 ? -1 : split(jb, i0, i1, mid, j1);
+}
+
+static void *worker(void *arg)
+{
+    job *jb = arg;
+    tile *t;
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&jb->lock);
+        i = jb->next++;
+        pthread_mutex_unlock(&jb->lock);
+        if (i >= jb->ntiles)
+            return NULL;
+        t = &jb->tiles[i];
+        transpose(jb, t->i0, t->i1, t->j0, t->j1);
+    }
+}
+
+int ptrans(size_t M, size_t N, const double *A, double *B, int nthreads)
+{
+    pthread_t *tids;
+    job jb;
+    int i, started;
+
+    if (M == 0 || N == 0)
+        return 0;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    jb.M = M;
+    jb.N = N;
+    jb.A = A;
+    jb.B = B;
+    jb.tile_area = M * N / ((size_t) nthreads * TILES_PER_THREAD);
+    if (jb.tile_area < MIN_TILE)
+        jb.tile_area = MIN_TILE;
+    jb.tiles = NULL;
+    jb.ntiles = 0;
+    jb.maxtiles = 0;
+    jb.next = 0;
+    tids = malloc(nthreads * sizeof(pthread_t));
+    if (tids == NULL || split(&jb, 0, N, 0, M) < 0) {
+        free(jb.tiles);
+        free(tids);
+        return -1;
+    }
+    pthread_mutex_init(&jb.lock, NULL);
+    if (nthreads > jb.ntiles)
+        nthreads = jb.ntiles;
+
+    /* The calling thread works too, and finishes whatever threads that
+     * failed to start would have done */
+    for (started = 0; started < nthreads - 1; started++) {
+        if (pthread_create(&tids[started], NULL, worker, &jb) != 0)
+            break;
+    }
+    worker(&jb);
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    pthread_mutex_destroy(&jb.lock);
+    free(jb.tiles);
+    free(tids);
+    return 0;
+}
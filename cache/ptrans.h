@@ -0,0 +1,20 @@
+/*
+ * ptrans.h - Multithreaded cache-oblivious transpose of large matrices
+ *
+ * Unlike the functions in trans.c, ptrans works on heap matrices of any
+ * size, not bounded by MAXN:
+ *
+ *      double *A = malloc(N * M * sizeof(double));  (N rows of M)
+ *      double *B = malloc(M * N * sizeof(double));  (M rows of N)
+ *      ptrans(M, N, A, B, 8);
+ */
+#ifndef CACHELAB_PTRANS_H
+#define CACHELAB_PTRANS_H
+
+#include <stddef.h>
+
+/* Write the transpose of A into B on up to nthreads threads.  Returns
+ * 0, or -1 (leaving B untouched) if it runs out of memory. */
+int ptrans(size_t M, size_t N, const double *A, double *B, int nthreads);
+
+#endif /* CACHELAB_PTRANS_H */
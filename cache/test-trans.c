@@ -3,6 +3,7 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -15,19 +16,7 @@
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for LONG_MAX
 #include <stdbool.h>
-
-/* Grading parameters */
-// Number of clock cycles for hit
-#define HIT_CYCLES 4
-// Number of clock cycles for miss
-#define MISS_CYCLES 100
-// Log number of sets
-#define TEST_LOG_SET 5
-// Associativity
-#define TEST_ASSOC 1
-// Log number of bytes / block
-#define TEST_LOG_BLOCK 6
-
+#include <pthread.h>
 
 /* The description string for the transpose_submit() function that the
    student submits for credit */
@@ -44,6 +33,34 @@ extern int func_counter;
 static size_t M = 0;
 static size_t N = 0;
 
+/* Shapes to evaluate (-S, or just M x N); the first one is graded */
+static size_t (*shapes)[2];
+static int nshapes;
+
+/* One function on one shape.  Each job runs its own tracegen-ct and
+ * reads the results from its own pipe, so jobs share no files and any
+ * number of them can run at once */
+struct job {
+    int funcid;
+    size_t M;
+    size_t N;
+    int status;     /* 0, or one of the JOB_ errors below */
+    int badfunc;    /* function tracegen-ct reported invalid */
+    long hits;
+    long misses;
+    long evictions;
+};
+#define JOB_NORUN 1    /* tracegen-ct could not be started */
+#define JOB_INVALID 2  /* the function failed validation */
+#define JOB_NOSIM 3    /* no simulator results */
+
+/* The worker pool hands out jobs in order */
+static struct job *jobs;
+static int njobs;
+static int nextjob;
+static unsigned int sim_s, sim_E, sim_b;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* The correctness and performance for the submitted transpose function */
 struct results {
     int funcid;
@@ -61,96 +78,229 @@ long get_clock_cycles(long hits, long misses) {
     return clock_cycles;
 }
 
-/* 
- * eval_perf - Evaluate the performance of the registered transpose functions
+/*
+ * run_job - Validate and simulate one function on one shape.
+ *     tracegen-ct feeds its trace straight into an LRU cache of libcsim
+ *     in-process and prints the results, so no trace file is made.
  */
-void eval_perf(unsigned int s, unsigned int E, unsigned int b, 
-               bool submission_only)
+void run_job(struct job *j)
 {
-    int i, flag;
-    long hits, misses, evictions;
-    char cmd[255], file_name[255];
-    int rval;
-
-    registerFunctions(); 
+    char cmd[255];
+    FILE *sim;
+    int got, flag;
+
+    sprintf(cmd, "./tracegen-ct -c %u:%u:%u -M %zd -N %zd -F %d",
+            sim_s, sim_E, sim_b, j->M, j->N, j->funcid);
+    sim = popen(cmd, "r");
+    if (sim == NULL) {
+        j->status = JOB_NORUN;
+        return;
+    }
+    got = fscanf(sim, " hits:%ld misses:%ld evictions:%ld",
+                 &j->hits, &j->misses, &j->evictions);
+    flag = WEXITSTATUS(pclose(sim));
+    if (0 != flag) {
+        j->status = JOB_INVALID;
+        j->badfunc = flag-1;
+    } else if (3 != got) {
+        j->status = JOB_NOSIM;
+    }
+}
 
-    /* Open the complete trace file */
-    FILE* full_trace_fp;  
+void *job_worker(void *arg)
+{
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&job_lock);
+        i = nextjob++;
+        pthread_mutex_unlock(&job_lock);
+        if (i >= njobs)
+            return NULL;
+        run_job(&jobs[i]);
+    }
+}
 
-    /* Evaluate the performance of each registered transpose function */
+/* Order jobs by shape, then by cycles, failed ones last */
+int rank_jobs(const void *x, const void *y)
+{
+    const struct job *a = *(const struct job **) x;
+    const struct job *b = *(const struct job **) y;
+    long ca, cb;
+
+    if (a->M != b->M)
+        return a->M < b->M ? -1 : 1;
+    if (a->N != b->N)
+        return a->N < b->N ? -1 : 1;
+    if ((a->status != 0) != (b->status != 0))
+        return a->status != 0 ? 1 : -1;
+    ca = get_clock_cycles(a->hits, a->misses);
+    cb = get_clock_cycles(b->hits, b->misses);
+    if (ca != cb)
+        return ca < cb ? -1 : 1;
+    return a->funcid - b->funcid;
+}
 
-    for (i=0; i<func_counter; i++) {
-        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
-            results.funcid = i; /* remember which function is the submission */
-        else if (submission_only)
+/*
+ * print_ranking - Rank every evaluated function within each shape
+ */
+void print_ranking()
+{
+    struct job **order = malloc(njobs * sizeof(struct job *));
+    int i, rank = 0;
+
+    for (i = 0; i < njobs; i++)
+        order[i] = &jobs[i];
+    qsort(order, njobs, sizeof(struct job *), rank_jobs);
+
+    printf("\nRanking (s=%d, E=%d, b=%d)\n", sim_s, sim_E, sim_b);
+    printf("%-9s %4s %4s %10s %8s %12s  %s\n", "shape", "rank", "func",
+           "misses", "hits", "clock_cycles", "description");
+    for (i = 0; i < njobs; i++) {
+        struct job *j = order[i];
+        char shape[32];
+
+        if (i == 0 || j->M != order[i-1]->M || j->N != order[i-1]->N)
+            rank = 0;
+        sprintf(shape, "%zdx%zd", j->M, j->N);
+        if (j->status != 0) {
+            printf("%-9s %4s %4d %10s %8s %12s  %s\n", shape, "-",
+                   j->funcid, "-", "-", j->status == JOB_INVALID ?
+                   "invalid" : "error", func_list[j->funcid].description);
             continue;
+        }
+        printf("%-9s %4d %4d %10ld %8ld %12ld  %s\n", shape, ++rank,
+               j->funcid, j->misses, j->hits,
+               get_clock_cycles(j->hits, j->misses),
+               func_list[j->funcid].description);
+    }
+    free(order);
+}
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
+/* 
+ * eval_perf - Evaluate the performance of the registered transpose
+ *     functions on every shape, using nthreads concurrent workers
+ */
+void eval_perf(unsigned int s, unsigned int E, unsigned int b, 
+               bool submission_only, int nthreads)
+{
+    int i, k;
+    pthread_t *tids;
 
-        sprintf(file_name, "trace.f%d", i);
+    registerFunctions(); 
 
-        sprintf(cmd, "./tracegen-ct -M %ld -N %ld -F %d > %s", M, N, i, file_name);
-        flag=WEXITSTATUS(system(cmd));
-        if (0 != flag) {
-            printf("Validation error at function %d! Run ./tracegen-ct -v -M %zd -N %zd -F %d for details.\n",flag-1,M,N,i);
+    /* One job per function and shape, graded shape first */
+    jobs = calloc(nshapes * func_counter, sizeof(struct job));
+    for (k = 0; k < nshapes; k++) {
+        for (i=0; i<func_counter; i++) {
+            if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
+                results.funcid = i; /* remember which function is the submission */
+            else if (submission_only)
+                continue;
+            jobs[njobs].funcid = i;
+            jobs[njobs].M = shapes[k][0];
+            jobs[njobs].N = shapes[k][1];
+            njobs++;
+        }
+    }
+
+    sim_s = s;
+    sim_E = E;
+    sim_b = b;
+    if (nthreads > njobs)
+        nthreads = njobs;
+    tids = malloc(nthreads * sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, job_worker, NULL);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    free(tids);
+
+    /* Report in job order, as a serial run would */
+    for (k = 0; k < njobs; k++) {
+        struct job *j = &jobs[k];
+        bool graded = (j->M == shapes[0][0] && j->N == shapes[0][1]);
+
+        i = j->funcid;
+        if (nshapes > 1)
+            printf("\nShape %zdx%zd", j->M, j->N);
+        printf("\nFunction %d (%d total)\nStep 1: Validating and simulating (s=%d, E=%d, b=%d)\n",
+               i, func_counter, s, E, b);
+        if (j->status == JOB_NORUN) {
+            printf("Unable to run ./tracegen-ct\n");
+            continue;
+        }
+        if (j->status == JOB_INVALID) {
+            printf("Validation error at function %d! Run ./tracegen-ct -v -M %zd -N %zd -F %d for details.\n",
+                   j->badfunc, j->M, j->N, i);
             continue;
         }
-        func_list[i].correct=true;
 
         /* Save the correctness of the transpose submission */
-        if (results.funcid == i ) {
-            results.correct = true;
+        if (graded) {
+            func_list[i].correct=true;
+            if (results.funcid == i)
+                results.correct = true;
         }
 
-
-        /* Run the reference simulator */
-        full_trace_fp = fopen(file_name, "r");
-        assert(full_trace_fp);
-
-
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t %s > /dev/null", 
-                s, E, b, file_name);
-        rval = system(cmd);
-        if (rval) {
-            printf("Cache simulator error.  The reference simulator exited with value %d\n", rval);
-            continue;
-        }
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        if (3!=fscanf(in_fp, "%ld %ld %ld", &hits, &misses, &evictions)) {
+        if (j->status == JOB_NOSIM) {
             printf("Cache simulator error.  Simulator generated invalid results\n");
             continue;
         }
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
         printf("func %d (%s): hits:%ld, misses:%ld, evictions:%ld, clock_cycles:%ld\n",
-               i, func_list[i].description, hits, misses, evictions, get_clock_cycles(hits, misses));
-    
+               i, func_list[i].description, j->hits, j->misses, j->evictions,
+               get_clock_cycles(j->hits, j->misses));
+        if (!graded)
+            continue;
+        func_list[i].num_hits = j->hits;
+        func_list[i].num_misses = j->misses;
+        func_list[i].num_evictions = j->evictions;
+
         /* If it is transpose_submit(), record number of misses */
         if (results.funcid == i) {
-            results.misses = misses;
-            results.hits = hits;
+            results.misses = j->misses;
+            results.hits = j->hits;
         }
     }
-  
+
+    if (njobs > 1)
+        print_ranking();
+    free(jobs);
+}
+
+/*
+ * add_shapes - Parse a comma separated list of MxN shapes
+ */
+bool add_shapes(char *list)
+{
+    char *shape;
+    int m, n;
+
+    for (shape = strtok(list, ","); shape; shape = strtok(NULL, ",")) {
+        if (sscanf(shape, "%dx%d", &m, &n) != 2 || m <= 0 || n <= 0
+            || m > MAXN || n > MAXN)
+            return false;
+        shapes = realloc(shapes, (nshapes + 1) * sizeof(*shapes));
+        shapes[nshapes][0] = m;
+        shapes[nshapes][1] = n;
+        nshapes++;
+    }
+    return nshapes > 0;
 }
 
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] [-s] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-h] [-s] [-j <n>] -M <rows> -N <cols> | -S <shapes>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
     printf("  -s          Check official submission only.\n");
     printf("  -M <rows>   Number of destination matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of destination matrix columns (max %d)\n", MAXN);
+    printf("  -S <shapes> Evaluate every MxN in a comma separated list;\n");
+    printf("              the first one is graded\n");
+    printf("  -j <n>      Evaluate up to n functions/shapes at once\n");
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
 }
 
@@ -182,9 +332,9 @@ int main(int argc, char* argv[])
     char c;
     
     bool submission_only = false;
+    int nthreads = 1;
 
-
-    while ((c = getopt(argc,argv,"hcsM:N:")) != -1) {
+    while ((c = getopt(argc,argv,"hcsM:N:S:j:")) != -1) {
         switch(c) {
         case 'M':
             M = (size_t) atoi(optarg);
@@ -195,6 +345,18 @@ int main(int argc, char* argv[])
         case 's':
             submission_only = true;
             break;
+        case 'S':
+            if (!add_shapes(optarg)) {
+                printf("Error: Invalid shape list %s\n", optarg);
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads < 1)
+                nthreads = 1;
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -204,16 +366,22 @@ int main(int argc, char* argv[])
         }
     }
   
-    if (M == 0 || N == 0) {
-        printf("Error: Missing required argument\n");
-        usage(argv);
-        exit(1);
-    }
+    if (nshapes == 0) {
+        if (M == 0 || N == 0) {
+            printf("Error: Missing required argument\n");
+            usage(argv);
+            exit(1);
+        }
 
-    if (M > MAXN || N > MAXN) {
-        printf("Error: M or N exceeds %d\n", MAXN);
-        usage(argv);
-        exit(1);
+        if (M > MAXN || N > MAXN) {
+            printf("Error: M or N exceeds %d\n", MAXN);
+            usage(argv);
+            exit(1);
+        }
+        shapes = malloc(sizeof(*shapes));
+        shapes[0][0] = M;
+        shapes[0][1] = N;
+        nshapes = 1;
     }
 
     /* Install SIGSEGV and SIGALRM handlers */
@@ -232,7 +400,7 @@ int main(int argc, char* argv[])
 
     /* Check the performance of the student's transpose function */
     eval_perf(TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK,
-              submission_only);
+              submission_only, nthreads);
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
@@ -0,0 +1,186 @@
+/*
+ * trace.c - Reading and writing Cache Lab memory traces
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+struct trace {
+    FILE *fp;                  /* text traces and unmappable binary ones */
+    int binary;                /* nonzero for the binary format */
+    const trace_rec_t *recs;   /* mmapped or loaded records */
+    const trace_rec_t *cur;    /* next record to hand out */
+    const trace_rec_t *end;
+    void *map;                 /* whole mapping, header included */
+    size_t maplen;
+    trace_rec_t *loaded;       /* records read in by trace_load */
+    trace_rec_t scratch;       /* holds records that were parsed or read */
+};
+
+/*
+ * trace_open - Open a trace file, or stdin when path is "-".  Binary
+ *     traces in regular files are mmapped; everything else is streamed.
+ */
+trace_t *trace_open(const char *path)
+{
+    char magic[TRACE_MAGIC_LEN];
+    struct stat st;
+    trace_t *t = calloc(1, sizeof(trace_t));
+
+    if (t == NULL)
+        return NULL;
+    t->fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (t->fp == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    /* No text trace line starts with the first magic character, so one
+     * byte of lookahead is enough to tell the formats apart, even on a
+     * pipe */
+    int c = getc(t->fp);
+    if (c != TRACE_MAGIC[0]) {
+        if (c != EOF)
+            ungetc(c, t->fp);
+        return t;
+    }
+    magic[0] = c;
+    if (fread(magic + 1, 1, TRACE_MAGIC_LEN - 1, t->fp) != TRACE_MAGIC_LEN - 1
+        || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s: not a valid trace file\n", path);
+        trace_close(t);
+        return NULL;
+    }
+
+    t->binary = 1;
+    if (fstat(fileno(t->fp), &st) == 0 && S_ISREG(st.st_mode)
+        && (size_t) st.st_size >= TRACE_MAGIC_LEN) {
+        t->maplen = st.st_size;
+        t->map = mmap(NULL, t->maplen, PROT_READ, MAP_PRIVATE,
+                      fileno(t->fp), 0);
+        if (t->map != MAP_FAILED) {
+            size_t n = (t->maplen - TRACE_MAGIC_LEN) / sizeof(trace_rec_t);
+            madvise(t->map, t->maplen, MADV_SEQUENTIAL);
+            t->recs = (const trace_rec_t *)
+                ((const char *) t->map + TRACE_MAGIC_LEN);
+            t->cur = t->recs;
+            t->end = t->recs + n;
+        } else {
+            t->map = NULL;
+        }
+    }
+    return t;
+}
+
+/*
+ * trace_next - Hand out the next record.  Mapped binary traces return a
+ *     pointer straight into the mapping.
+ */
+const trace_rec_t *trace_next(trace_t *t)
+{
+    if (t->recs != NULL)
+        return t->cur < t->end ? t->cur++ : NULL;
+
+    if (t->binary) {
+        if (fread(&t->scratch, sizeof(trace_rec_t), 1, t->fp) != 1)
+            return NULL;
+        return &t->scratch;
+    }
+
+    unsigned long addr;
+    int size;
+    while (fscanf(t->fp, " %c %lx,%d", &t->scratch.op, &addr, &size) == 3) {
+        t->scratch.addr = addr;
+        t->scratch.size = size;
+        return &t->scratch;
+    }
+    return NULL;
+}
+
+long trace_count(trace_t *t)
+{
+    if (t->recs == NULL)
+        return -1;
+    return t->end - t->recs;
+}
+
+const trace_rec_t *trace_load(trace_t *t, long *count)
+{
+    const trace_rec_t *rec;
+    trace_rec_t *recs = NULL;
+    long n = 0, cap = 0;
+
+    if (t->recs == NULL) {
+        while ((rec = trace_next(t)) != NULL) {
+            if (n == cap) {
+                cap = cap ? 2 * cap : 4096;
+                trace_rec_t *grown = realloc(recs, cap * sizeof(trace_rec_t));
+                if (grown == NULL) {
+                    free(recs);
+                    return NULL;
+                }
+                recs = grown;
+            }
+            recs[n++] = *rec;
+        }
+        t->loaded = recs;
+        t->recs = recs;
+        t->end = recs + n;
+    }
+    t->cur = t->recs;
+    *count = t->end - t->recs;
+    return t->recs;
+}
+
+void trace_close(trace_t *t)
+{
+    if (t->map != NULL)
+        munmap(t->map, t->maplen);
+    free(t->loaded);
+    if (t->fp != stdin)
+        fclose(t->fp);
+    free(t);
+}
+
+int trace_write_header(FILE *out)
+{
+    return fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, out) == TRACE_MAGIC_LEN
+        ? 0 : -1;
+}
+
+int trace_write_rec(FILE *out, char op, uint64_t addr, uint32_t size)
+{
+    trace_rec_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.op = op;
+    rec.addr = addr;
+    rec.size = size;
+    return fwrite(&rec, sizeof(rec), 1, out) == 1 ? 0 : -1;
+}
+
+/*
+ * trace_convert - Text to binary conversion, shared by trace2bin and
+ *     tracegen-ct -b
+ */
+long trace_convert(FILE *in, FILE *out)
+{
+    char op;
+    unsigned long addr;
+    int size;
+    long count = 0;
+
+    if (trace_write_header(out) < 0)
+        return -1;
+    while (fscanf(in, " %c %lx,%d", &op, &addr, &size) == 3) {
+        if (trace_write_rec(out, op, addr, size) < 0)
+            return -1;
+        count++;
+    }
+    return fflush(out) == 0 ? count : -1;
+}
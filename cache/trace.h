@@ -0,0 +1,60 @@
+/*
+ * trace.h - Reading and writing Cache Lab memory traces
+ *
+ * Traces come in two flavours.  The text format is the one produced by
+ * valgrind/lackey and tracegen-ct, one access per line:
+ *
+ *      L 7ff000398,8
+ *
+ * The binary format is a short header followed by fixed-width records
+ * that are laid out exactly like trace_rec_t, so a reader can mmap the
+ * file and walk the records in place without any parsing.
+ */
+#ifndef CACHELAB_TRACE_H
+#define CACHELAB_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Magic string at the start of every binary trace */
+#define TRACE_MAGIC "CLTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+/* One memory access; this is also the on-disk binary record */
+typedef struct {
+    uint64_t addr;  /* byte address of the access */
+    uint32_t size;  /* number of bytes accessed */
+    char op;        /* 'L', 'S', 'M' or 'I', as in the text format */
+    char pad[3];    /* keeps records 16 bytes wide */
+} trace_rec_t;
+
+/* An open trace, either mmapped binary or a text stream */
+typedef struct trace trace_t;
+
+/* Open a trace ("-" for stdin), detecting the format from its first
+ * bytes.  Returns NULL if the file cannot be opened or is malformed. */
+trace_t *trace_open(const char *path);
+
+/* Return the next access, or NULL at the end of the trace.  The record
+ * stays valid until the next call to trace_next or trace_close. */
+const trace_rec_t *trace_next(trace_t *t);
+
+/* Number of records in a binary or loaded trace, or -1 for a stream */
+long trace_count(trace_t *t);
+
+/* Make the whole trace available as one array and rewind trace_next to
+ * its start.  Mapped binary traces are used in place; anything else is
+ * read into memory.  Returns NULL if memory runs out. */
+const trace_rec_t *trace_load(trace_t *t, long *count);
+
+void trace_close(trace_t *t);
+
+/* Write the binary header / one binary record to an output stream */
+int trace_write_header(FILE *out);
+int trace_write_rec(FILE *out, char op, uint64_t addr, uint32_t size);
+
+/* Read text trace lines from in and write them to out in binary form.
+ * Returns the number of records converted, or -1 on a write error. */
+long trace_convert(FILE *in, FILE *out);
+
+#endif /* CACHELAB_TRACE_H */
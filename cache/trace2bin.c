@@ -0,0 +1,44 @@
+/*
+ * trace2bin.c - Convert a text memory trace into the binary format that
+ *     csim can mmap (see trace.h).
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+int main(int argc, char *argv[])
+{
+    FILE *in, *out;
+    long count;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <in.trace|-> <out.btrace|->\n", argv[0]);
+        exit(1);
+    }
+
+    in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    out = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "w");
+    if (out == NULL) {
+        perror(argv[2]);
+        exit(1);
+    }
+
+    count = trace_convert(in, out);
+    if (count < 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+    fprintf(stderr, "%ld records\n", count);
+
+    if (in != stdin)
+        fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
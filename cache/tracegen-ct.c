@@ -14,6 +14,8 @@
 #include <unistd.h>
 #include <getopt.h>
 #include "cachelab.h"
+#include "trace.h"
+#include "libcsim.h"
 #include <string.h>
 #include <stdbool.h>
 
@@ -30,15 +32,52 @@ extern void registerFunctions();
 extern void __roi_begin();
 extern void __roi_end();
 
-/* Need to make sure A and B start on cache block boundaries */
-static double bigA[MAXN][MAXN] __attribute__((aligned(64)));
-static double bigB[MAXN][MAXN] __attribute__((aligned(64)));
-static double bigT[TMPCOUNT]  __attribute__((aligned(64)));
+/* Receives every traced access (ct/tap.c) */
+extern void (*ct_tap)(char op, unsigned long addr, unsigned int size);
+/* Checks ct/tap.c decodes the runtime's buffers; 0 if it does */
+extern int ct_tap_check(void);
+
+/* Need to make sure A and B start on cache block boundaries.  They and
+ * tmp share one arena, so their layout (B after A, tmp after B) is the
+ * one autotune replays, whatever order statics are placed in */
+static trans_arena_t big __attribute__((aligned(64)));
 static double bigAcopy[MAXN][MAXN];
 static double bigBtarg[MAXN][MAXN];
 static size_t M;
 static size_t N;
 
+/* Without -b or -c the tracing runtime prints a text trace.  With -b,
+ * each access is written to stdout as a binary record as it arrives */
+static bool write_failed;
+
+static void bin_write(char op, unsigned long addr, unsigned int size) {
+    if (!write_failed && trace_write_rec(stdout, op, addr, size) < 0) {
+        fprintf(stderr, "Failure writing binary trace\n");
+        write_failed = true;
+    }
+}
+
+/* For -c, each access goes straight into an LRU cache of libcsim, the
+ * policy transposes are graded on, and the results are printed at exit,
+ * once the runtime's writer thread has drained; no trace is ever
+ * written out */
+static csim_t *sim;
+
+static void sim_access(char op, unsigned long addr, unsigned int size) {
+    csim_access(sim, op, addr, size);
+}
+
+static void sim_finish(void) {
+    csim_stats_t stats;
+
+    csim_stats(sim, &stats);
+    printf("hits:%ld misses:%ld evictions:%ld "
+           "dirty_bytes_in_cache:%ld dirty_bytes_evicted:%ld\n",
+           stats.hits, stats.misses, stats.evictions,
+           stats.dirty_bytes_in_cache, stats.dirty_bytes_evicted);
+    csim_free(sim);
+}
+
 
 bool validate(int fn, double A[N][M], double Acopy[N][M], double B[M][N], double Btarg[M][N]) {
     size_t i, j;
@@ -77,7 +116,9 @@ bool validate(int fn, double A[N][M], double Acopy[N][M], double B[M][N], double
 }
 
 static void usage(char *cmd) {
-    fprintf(stderr, "Usage: %s [-h] [-M M] [-N N] [-F ID]\n", cmd);
+    fprintf(stderr, "Usage: %s [-h] [-b | -c s:E:b] [-M M] [-N N] [-F ID]\n", cmd);
+    fprintf(stderr, "  -b      Emit the trace in binary format\n");
+    fprintf(stderr, "  -c s:E:b  Simulate the cache instead of emitting a trace\n");
     fprintf(stderr, "  -N N    Set number of rows of A / cols of B\n");
     fprintf(stderr, "  -M M    Set number of cols of A / rows of B\n");
     fprintf(stderr, "  -F ID   Run function number ID\n");
@@ -89,7 +130,9 @@ int entry(int argc, char* argv[]){
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"hvM:N:F:")) != -1){
+    bool binary = false;
+    int s, E, b;
+    while( (c=getopt(argc,argv,"hvbc:M:N:F:")) != -1){
         switch(c){
         case 'M':
             M = (size_t) atoi(optarg);
@@ -102,6 +145,16 @@ int entry(int argc, char* argv[]){
             break;
         case 'v':
             break;
+        case 'b':
+            binary = true;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d:%d:%d", &s, &E, &b) != 3)
+                usage(argv[0]);
+            sim = csim_new(s, E, b, "lru");
+            if (sim == NULL)
+                exit(1);
+            break;
         case 'h':
         default:
             usage(argv[0]);
@@ -110,40 +163,57 @@ int entry(int argc, char* argv[]){
     assert((M > 0) && (M <= MAXN));
     assert((N > 0) && (N <= MAXN));
 
+    /* Every mode reads the runtime's buffers through ct/tap.c */
+    if (ct_tap_check() < 0)
+        exit(1);
+
+    if (binary && sim != NULL)
+        usage(argv[0]);
+    if (binary) {
+        if (trace_write_header(stdout) < 0) {
+            fprintf(stderr, "Failure writing binary trace\n");
+            exit(1);
+        }
+        ct_tap = bin_write;
+    } else if (sim != NULL) {
+        ct_tap = sim_access;
+        atexit(sim_finish);
+    }
+
     /*  Register transpose functions */
     registerFunctions();
 
     /* Clear out matrices */
-    memset(bigA, 0, sizeof(bigA));
-    memset(bigB, 0, sizeof(bigB));
+    memset(big.A, 0, sizeof(big.A));
+    memset(big.B, 0, sizeof(big.B));
     
     /* Fill A with data */
-    initMatrix(M,N, bigA, bigB);
+    initMatrix(M,N, big.A, big.B);
     /* Make copy of A */
     memset(bigAcopy, 0, sizeof(bigAcopy));
-    copyMatrix(M,N, bigAcopy, bigA);
+    copyMatrix(M,N, bigAcopy, big.A);
     /* Generate target version */
     memset(bigBtarg, 0, sizeof(bigBtarg));
-    correctTrans(M,N, bigA, bigBtarg);
+    correctTrans(M,N, big.A, bigBtarg);
 
 
     if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
         for (i=0; i < func_counter; i++) {
-            memset(bigT, 0, sizeof(bigT));
+            memset(big.tmp, 0, sizeof(big.tmp));
             __roi_begin();
-            (*func_list[i].func_ptr)(M, N, bigA, bigB, bigT);
+            (*func_list[i].func_ptr)(M, N, big.A, big.B, big.tmp);
             __roi_end();
-            if (!validate(i,bigA,bigAcopy,bigB,bigBtarg)) {
+            if (!validate(i,big.A,bigAcopy,big.B,bigBtarg)) {
                 return i+1;
             }
         }
     } else {
-        memset(bigT, 0, sizeof(bigT));
+        memset(big.tmp, 0, sizeof(big.tmp));
         __roi_begin();
-        (*func_list[selectedFunc].func_ptr)(M, N, bigA, bigB, bigT);
+        (*func_list[selectedFunc].func_ptr)(M, N, big.A, big.B, big.tmp);
         __roi_end();
-        if (!validate(selectedFunc,bigA,bigAcopy,bigB,bigBtarg)) {
+        if (!validate(selectedFunc,big.A,bigAcopy,big.B,bigBtarg)) {
             return 1;
         }
 
@@ -24,11 +24,16 @@
 #include <stdbool.h>
 #include "cachelab.h"
 #include "contracts.h"
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 
 /* Forward declarations */
 bool is_transpose(size_t M, size_t N, double A[N][M], double B[M][N]);
 void trans(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp);
 void trans_tmp(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp);
+void trans_blocked(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp);
+void trans_simd(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp);
 
 /*
  * transpose_submit - This is the solution transpose function that you
@@ -48,7 +53,7 @@ int min(int x, int y) {
 void transpose_submit(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp)
 {
     size_t row, col, i, j; /* i = index for row, j = index for col*/
-    size_t d; /* for indexing diagonals */
+    size_t d = 0; /* for indexing diagonals */
     /* if A is 32 x 32 matrix */
     /* since a block can hold 8 double ints, we transfer 8 doubles at once */
     /* also, to utlizie spatial locality of B, we proceed to next row after
@@ -163,6 +168,98 @@ void trans_tmp(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp)
     ENSURES(is_transpose(M, N, A, B));
 }
 
+/*
+ * The two kernels below are meant for large matrices on real hardware
+ * (see bench-trans), not for the simulated 2KB cache.  A 32x32 block
+ * of A and its image in B take 16KB, so both fit in a typical L1D.
+ */
+#define TBLOCK 32
+
+char trans_blocked_desc[] = "Blocked 32x32 scan transpose";
+
+void trans_blocked(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp)
+{
+    size_t row, col, i, j;
+
+    for (row = 0; row < N; row += TBLOCK) {
+        for (col = 0; col < M; col += TBLOCK) {
+            for (i = row; i < min(row + TBLOCK, N); i++) {
+                for (j = col; j < min(col + TBLOCK, M); j++) {
+                    B[j][i] = A[i][j];
+                }
+            }
+        }
+    }
+}
+
+/*
+ * tile4x4 - Transpose the 4x4 tile of A at (i, j) into B.  With AVX,
+ *     the four rows are loaded into registers and transposed with
+ *     shuffles, so A and B are each touched with four 32-byte accesses.
+ *     The vector registers hold doubles only transiently, as a scalar
+ *     copy does, and never hide array data in memory.  Without AVX
+ *     (as when tracegen-ct compiles this file) it is a scalar loop.
+ */
+static void tile4x4(size_t M, size_t N, double A[N][M], double B[M][N],
+                    size_t i, size_t j)
+{
+#ifdef __AVX__
+    __m256d r0 = _mm256_loadu_pd(&A[i][j]);
+    __m256d r1 = _mm256_loadu_pd(&A[i + 1][j]);
+    __m256d r2 = _mm256_loadu_pd(&A[i + 2][j]);
+    __m256d r3 = _mm256_loadu_pd(&A[i + 3][j]);
+    /* t0 = a00 a10 a02 a12, t1 = a01 a11 a03 a13, and so on */
+    __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+    __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+    __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+    __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+
+    _mm256_storeu_pd(&B[j][i], _mm256_permute2f128_pd(t0, t2, 0x20));
+    _mm256_storeu_pd(&B[j + 1][i], _mm256_permute2f128_pd(t1, t3, 0x20));
+    _mm256_storeu_pd(&B[j + 2][i], _mm256_permute2f128_pd(t0, t2, 0x31));
+    _mm256_storeu_pd(&B[j + 3][i], _mm256_permute2f128_pd(t1, t3, 0x31));
+#else
+    size_t r, c;
+
+    for (r = i; r < i + 4; r++) {
+        for (c = j; c < j + 4; c++) {
+            B[c][r] = A[r][c];
+        }
+    }
+#endif
+}
+
+char trans_simd_desc[] = "Blocked 32x32 transpose of 4x4 register tiles";
+
+void trans_simd(size_t M, size_t N, double A[N][M], double B[M][N], double *tmp)
+{
+    size_t row, col, i, j, r, iend, jend;
+
+    for (row = 0; row < N; row += TBLOCK) {
+        for (col = 0; col < M; col += TBLOCK) {
+            iend = min(row + TBLOCK, N);
+            jend = min(col + TBLOCK, M);
+            for (i = row; i + 4 <= iend; i += 4) {
+                for (j = col; j + 4 <= jend; j += 4) {
+                    tile4x4(M, N, A, B, i, j);
+                }
+                /* Columns left over at the right edge of the block */
+                for (; j < jend; j++) {
+                    for (r = i; r < i + 4; r++) {
+                        B[j][r] = A[r][j];
+                    }
+                }
+            }
+            /* Rows left over at the bottom edge of the block */
+            for (; i < iend; i++) {
+                for (j = col; j < jend; j++) {
+                    B[j][i] = A[i][j];
+                }
+            }
+        }
+    }
+}
+
 /*
  * registerFunctions - This function registers your transpose
  *     functions with the driver.  At runtime, the driver will
@@ -178,6 +275,8 @@ void registerFunctions()
     /* Register any additional transpose functions */
     registerTransFunction(trans, trans_desc);
     registerTransFunction(trans_tmp, trans_tmp_desc);
+    registerTransFunction(trans_blocked, trans_blocked_desc);
+    registerTransFunction(trans_simd, trans_simd_desc);
 
 }
 